@@ -3,199 +3,2857 @@
 #include <set>
 #include <algorithm>
 #include <random>
-#include <ctime>
 #include <queue>
+#include <string>
+#include <bitset>
+#include <cstdint>
+#include <cassert>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <cmath>
+#include <sstream>
+#include <fstream>
+#include <chrono>
+#include <cstring>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#define LAB2_MMAP
+#define LAB2_RUSAGE
+#endif
 
 using namespace std;
 
+using PatentWord = uint64_t;
+const int PATENT_WORD_BITS = 64;
+
+inline int lowestSetBit(PatentWord word) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, word);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctzll(word);
+#endif
+}
+
+inline int countPatentBits(const PatentWord* words, int fromWord, int toWord) {
+    int total = 0;
+    for (int w = fromWord; w < toWord; w++) total += static_cast<int>(bitset<PATENT_WORD_BITS>(words[w]).count());
+    return total;
+}
+
+inline void setPatentBit(PatentWord* words, int patentId) {
+    words[patentId / PATENT_WORD_BITS] |= PatentWord(1) << (patentId % PATENT_WORD_BITS);
+}
+
+inline void clearPatentBit(PatentWord* words, int patentId) {
+    words[patentId / PATENT_WORD_BITS] &= ~(PatentWord(1) << (patentId % PATENT_WORD_BITS));
+}
+
+inline bool testPatentBit(const PatentWord* words, int patentId) {
+    return (words[patentId / PATENT_WORD_BITS] >> (patentId % PATENT_WORD_BITS)) & 1;
+}
+
+inline int patentWordsFor(int patentSpace) {
+    return (patentSpace + PATENT_WORD_BITS - 1) / PATENT_WORD_BITS;
+}
+
+inline int findPatentAtRank(const PatentWord* words, int fromWord, int toWord, int rank) {
+    for (int w = fromWord; w < toWord; w++) {
+        int bits = static_cast<int>(bitset<PATENT_WORD_BITS>(words[w]).count());
+        if (rank < bits) {
+            PatentWord word = words[w];
+            for (; rank > 0; rank--) word &= word - 1;
+            return w * PATENT_WORD_BITS + lowestSetBit(word);
+        }
+        rank -= bits;
+    }
+    return -1;
+}
+
+struct HeldWord {
+    int index;
+    PatentWord bits;
+};
+
+inline void sortPatentIds(vector<int>& patents) {
+    sort(patents.begin(), patents.end());
+    patents.erase(unique(patents.begin(), patents.end()), patents.end());
+}
+
+inline int sortPatentIds(int* first, int* last) {
+    sort(first, last);
+    return static_cast<int>(unique(first, last) - first);
+}
+
+inline const HeldWord* findHeldWord(const HeldWord* first, const HeldWord* last, int wordIndex) {
+    return lower_bound(first, last, wordIndex, [](const HeldWord& held, int index) { return held.index < index; });
+}
+
+inline HeldWord* findHeldWord(HeldWord* first, HeldWord* last, int wordIndex) {
+    return lower_bound(first, last, wordIndex, [](const HeldWord& held, int index) { return held.index < index; });
+}
+
+inline int findFirstMissingHeld(const PatentWord* missing, int firstWord, int endWord, const HeldWord* held, const HeldWord* heldEnd) {
+    for (const HeldWord* h = findHeldWord(held, heldEnd, firstWord); h != heldEnd && h->index < endWord; ++h) {
+        PatentWord common = missing[h->index - firstWord] & h->bits;
+        if (common) return h->index * PATENT_WORD_BITS + lowestSetBit(common);
+    }
+    return -1;
+}
+
+inline void buildMissingWindow(PatentWord* missing, int firstWord, int endWord, const int* target, const int* targetEnd,
+    const HeldWord* held, const HeldWord* heldEnd) {
+    for (const int* t = target; t != targetEnd; ++t) setPatentBit(missing, *t - firstWord * PATENT_WORD_BITS);
+    for (const HeldWord* h = findHeldWord(held, heldEnd, firstWord); h != heldEnd && h->index < endWord; ++h) {
+        missing[h->index - firstWord] &= ~h->bits;
+    }
+}
+
+inline void appendHeldPatents(const HeldWord* held, const HeldWord* heldEnd, vector<int>& out) {
+    for (const HeldWord* h = held; h != heldEnd; ++h) {
+        for (PatentWord word = h->bits; word; word &= word - 1) {
+            out.push_back(h->index * PATENT_WORD_BITS + lowestSetBit(word));
+        }
+    }
+}
+
+inline void accumulateHeldWords(const HeldWord* held, const HeldWord* heldEnd, PatentWord* patents) {
+    for (const HeldWord* h = held; h != heldEnd; ++h) patents[h->index] |= h->bits;
+}
+
+inline bool windowIntersects(const PatentWord* window, int firstWord, int endWord, const PatentWord* patents) {
+    for (int w = firstWord; w < endWord; w++) {
+        if (window[w - firstWord] & patents[w]) return true;
+    }
+    return false;
+}
+
+inline int windowPatentAtRank(const PatentWord* window, int firstWord, int endWord, int rank) {
+    int local = findPatentAtRank(window, 0, endWord - firstWord, rank);
+    return local == -1 ? -1 : local + firstWord * PATENT_WORD_BITS;
+}
+
+inline bool windowContains(const PatentWord* window, int firstWord, int endWord, int patentId) {
+    int w = patentId / PATENT_WORD_BITS;
+    return w >= firstWord && w < endWord && testPatentBit(window, patentId - firstWord * PATENT_WORD_BITS);
+}
+
+inline int countMissingHeld(const PatentWord* missing, int firstWord, int endWord, const HeldWord* held, const HeldWord* heldEnd) {
+    int total = 0;
+    for (const HeldWord* h = findHeldWord(held, heldEnd, firstWord); h != heldEnd && h->index < endWord; ++h) {
+        total += static_cast<int>(bitset<PATENT_WORD_BITS>(missing[h->index - firstWord] & h->bits).count());
+    }
+    return total;
+}
+
+template <class F>
+void forEachWindowPatent(const PatentWord* window, int firstWord, int endWord, F f) {
+    for (int w = firstWord; w < endWord; w++) {
+        for (PatentWord word = window[w - firstWord]; word; word &= word - 1) f(w * PATENT_WORD_BITS + lowestSetBit(word));
+    }
+}
+
+struct ExchangeRecord {
+    int received = -1;
+    int given = -1;
+};
+
+class InitialHoldings {
+public:
+    void clear() {
+        patents.clear();
+        holders.clear();
+        dealt = false;
+    }
+
+    void add(int holder, int patentId) {
+        holders.push_back(holder);
+        patents.push_back(patentId);
+    }
+
+    void addDealt(const int* first, const int* last) {
+        dealt = true;
+        patents.insert(patents.end(), first, last);
+    }
+
+    template <class Engine>
+    void shuffleDealt(Engine& engine) {
+        shuffle(patents.begin(), patents.end(), engine);
+    }
+
+    void bucket(int agentCount) {
+        offsets.assign(agentCount + 1, 0);
+        for (size_t k = 0; k < patents.size(); k++) offsets[holderOf(k, agentCount) + 1]++;
+        for (int i = 0; i < agentCount; i++) offsets[i + 1] += offsets[i];
+        sorted.resize(patents.size());
+        cursor.assign(offsets.begin(), offsets.end() - 1);
+        for (size_t k = 0; k < patents.size(); k++) sorted[cursor[holderOf(k, agentCount)]++] = patents[k];
+        counts.resize(agentCount);
+        words.assign(agentCount, 0);
+        for (int i = 0; i < agentCount; i++) {
+            counts[i] = sortPatentIds(sorted.data() + offsets[i], sorted.data() + offsets[i + 1]);
+            int lastWord = -1;
+            for (const int* patent = begin(i); patent != end(i); ++patent) {
+                if (*patent / PATENT_WORD_BITS != lastWord) words[i]++;
+                lastWord = *patent / PATENT_WORD_BITS;
+            }
+        }
+    }
+
+    const vector<int>& wordCounts() const { return words; }
+    const int* begin(int i) const { return sorted.data() + offsets[i]; }
+    const int* end(int i) const { return begin(i) + counts[i]; }
+
+private:
+    vector<int> patents;
+    vector<int> holders;
+    vector<size_t> offsets;
+    vector<size_t> cursor;
+    vector<int> sorted;
+    vector<int> counts;
+    vector<int> words;
+    bool dealt = false;
+
+    int holderOf(size_t k, int agentCount) const {
+        return dealt ? static_cast<int>(k % agentCount) : holders[k];
+    }
+};
+
 class Agent {
 public:
-    int id;
-    set<int> targetPatents;
-    set<int> currentPatents;
-    set<int> missingPatents;
-    int communicationRounds = 0;
-    int completionStep = 0;
+    int id;
+    int* targetPatents = nullptr;
+    int targetCount = 0;
+    HeldWord* currentPatents = nullptr;
+    int heldCount = 0;
+    int heldCapacity = 0;
+    PatentWord* missingPatents = nullptr;
+    int targetFirstWord = 0;
+    int targetEndWord = 0;
+    int missingCount = 0;
+    int communicationRounds = 0;
+    int completionStep = 0;
+
+    explicit Agent(int agentId) : id(agentId) {}
+
+    const HeldWord* currentPatentsEnd() const { return currentPatents + heldCount; }
+
+    void holdPatent(int patentId) {
+        int index = patentId / PATENT_WORD_BITS;
+        HeldWord* end = currentPatents + heldCount;
+        HeldWord* at = findHeldWord(currentPatents, end, index);
+        if (at == end || at->index != index) {
+            assert(heldCount < heldCapacity);
+            copy_backward(at, end, end + 1);
+            *at = { index, 0 };
+            heldCount++;
+        }
+        at->bits |= PatentWord(1) << (patentId % PATENT_WORD_BITS);
+    }
+
+    void holdInitialPatent(int patentId) {
+        int index = patentId / PATENT_WORD_BITS;
+        if (heldCount == 0 || currentPatents[heldCount - 1].index != index) {
+            assert(heldCount < heldCapacity && (heldCount == 0 || currentPatents[heldCount - 1].index < index));
+            currentPatents[heldCount++] = { index, 0 };
+        }
+        currentPatents[heldCount - 1].bits |= PatentWord(1) << (patentId % PATENT_WORD_BITS);
+    }
+
+    void acquirePatent(int patentId) {
+        holdPatent(patentId);
+        if (windowContains(missingPatents, targetFirstWord, targetEndWord, patentId)) {
+            clearPatentBit(missingPatents, patentId - targetFirstWord * PATENT_WORD_BITS);
+            missingCount--;
+        }
+#ifdef LAB2_VERIFY_MISSING
+        assert(missingPatentsConsistent());
+#endif
+    }
+
+    bool missingPatentsConsistent() const {
+        int wordCount = targetEndWord - targetFirstWord;
+        vector<PatentWord> expected(wordCount, 0);
+        buildMissingWindow(expected.data(), targetFirstWord, targetEndWord, targetPatents, targetPatents + targetCount,
+            currentPatents, currentPatentsEnd());
+        return equal(expected.begin(), expected.end(), missingPatents) && countPatentBits(expected.data(), 0, wordCount) == missingCount;
+    }
+
+    bool isComplete() const {
+        return missingCount == 0;
+    }
+
+    int findNeededPatent(const Agent& other) const {
+        return findFirstMissingHeld(missingPatents, targetFirstWord, targetEndWord, other.currentPatents, other.currentPatentsEnd());
+    }
+
+    int findGiveablePatent(const Agent& other) const {
+        return findFirstMissingHeld(other.missingPatents, other.targetFirstWord, other.targetEndWord, currentPatents, currentPatentsEnd());
+    }
+
+    bool exchangeWith(Agent& other, ExchangeRecord* record = nullptr) {
+        communicationRounds++;
+        other.communicationRounds++;
+
+        int needed = findNeededPatent(other);
+        if (needed == -1) return false;
+
+        int giveToOther = findGiveablePatent(other);
+
+        acquirePatent(needed);
+
+        if (giveToOther != -1) {
+            other.acquirePatent(giveToOther);
+        }
+
+        if (record) {
+            record->received = needed;
+            record->given = giveToOther;
+        }
+        return true;
+    }
+};
+
+class AgentList {
+public:
+    vector<Agent> agents;
+    vector<size_t> targetOffsets;
+    vector<int> targetIds;
+    vector<HeldWord> heldWords;
+    vector<PatentWord> missingWords;
+    InitialHoldings initialHoldings;
+    bool holdingsReserved = false;
+
+    void create(int count) {
+        agents.clear();
+        for (int i = 0; i < count; i++) agents.emplace_back(i);
+        targetOffsets.assign(count, 0);
+        targetIds.clear();
+        heldWords.clear();
+        missingWords.clear();
+        initialHoldings.clear();
+        holdingsReserved = false;
+    }
+
+    int size() const { return static_cast<int>(agents.size()); }
+    int id(int i) const { return agents[i].id; }
+    int targetCount(int i) const { return agents[i].targetCount; }
+    int communicationRounds(int i) const { return agents[i].communicationRounds; }
+    void setCommunicationRounds(int i, int rounds) { agents[i].communicationRounds = rounds; }
+    int completionStep(int i) const { return agents[i].completionStep; }
+    void setCompletionStep(int i, int step) { agents[i].completionStep = step; }
+    bool isComplete(int i) const { return agents[i].isComplete(); }
+
+    void addTargetPatent(int i, int patentId) {
+        if (agents[i].targetCount == 0) targetOffsets[i] = targetIds.size();
+        assert(targetOffsets[i] + agents[i].targetCount == targetIds.size());
+        targetIds.push_back(patentId);
+        agents[i].targetCount++;
+    }
+
+    void appendTargetPatents(int i, vector<int>& out) const {
+        const int* target = targetIds.data() + targetOffsets[i];
+        out.insert(out.end(), target, target + agents[i].targetCount);
+    }
+
+    void giveInitialPatent(int i, int patentId) { initialHoldings.add(i, patentId); }
+
+    template <class Engine>
+    void dealTargetPatents(Engine& engine) {
+        for (int i = 0; i < size(); i++) {
+            const int* target = targetIds.data() + targetOffsets[i];
+            initialHoldings.addDealt(target, target + agents[i].targetCount);
+        }
+        initialHoldings.shuffleDealt(engine);
+    }
+
+    void reserveHoldings(const vector<int>& initialWords) {
+        int count = size();
+        size_t heldTotal = 0, missingTotal = 0;
+        for (int i = 0; i < count; i++) {
+            Agent& agent = agents[i];
+            int* target = targetIds.data() + targetOffsets[i];
+            agent.targetCount = sortPatentIds(target, target + agent.targetCount);
+            agent.targetFirstWord = agent.targetCount ? target[0] / PATENT_WORD_BITS : 0;
+            agent.targetEndWord = agent.targetCount ? target[agent.targetCount - 1] / PATENT_WORD_BITS + 1 : 0;
+            agent.heldCapacity = initialWords[i] + (agent.targetEndWord - agent.targetFirstWord);
+            heldTotal += agent.heldCapacity;
+            missingTotal += agent.targetEndWord - agent.targetFirstWord;
+        }
+        heldWords.resize(heldTotal);
+        missingWords.assign(missingTotal, 0);
+
+        HeldWord* held = heldWords.data();
+        PatentWord* missing = missingWords.data();
+        for (int i = 0; i < count; i++) {
+            Agent& agent = agents[i];
+            agent.targetPatents = targetIds.data() + targetOffsets[i];
+            agent.currentPatents = held;
+            agent.heldCount = 0;
+            agent.missingPatents = missing;
+            held += agent.heldCapacity;
+            missing += agent.targetEndWord - agent.targetFirstWord;
+        }
+        holdingsReserved = true;
+    }
+
+    void holdInitialPatent(int i, int patentId) { agents[i].holdInitialPatent(patentId); }
+
+    void finishSetup() {
+        int count = size();
+        if (!holdingsReserved) {
+            initialHoldings.bucket(count);
+            reserveHoldings(initialHoldings.wordCounts());
+            for (int i = 0; i < count; i++) {
+                for (const int* patent = initialHoldings.begin(i); patent != initialHoldings.end(i); ++patent) holdInitialPatent(i, *patent);
+            }
+        }
+        for (int i = 0; i < count; i++) {
+            Agent& agent = agents[i];
+            buildMissingWindow(agent.missingPatents, agent.targetFirstWord, agent.targetEndWord, agent.targetPatents,
+                agent.targetPatents + agent.targetCount, agent.currentPatents, agent.currentPatentsEnd());
+            agent.missingCount = countPatentBits(agent.missingPatents, 0, agent.targetEndWord - agent.targetFirstWord);
+        }
+    }
+
+    int findNeededPatent(int i, int j) const {
+        return agents[i].findNeededPatent(agents[j]);
+    }
+
+    int findGiveablePatent(int i, int j) const {
+        return agents[i].findGiveablePatent(agents[j]);
+    }
+
+    int countNeededPatents(int i, int j) const {
+        const Agent& agent = agents[i];
+        return countMissingHeld(agent.missingPatents, agent.targetFirstWord, agent.targetEndWord, agents[j].currentPatents, agents[j].currentPatentsEnd());
+    }
+
+    template <class F>
+    void forEachMissingPatent(int i, F f) const {
+        const Agent& agent = agents[i];
+        forEachWindowPatent(agent.missingPatents, agent.targetFirstWord, agent.targetEndWord, f);
+    }
+
+    void accumulateHeldPatents(int i, PatentWord* held) const {
+        accumulateHeldWords(agents[i].currentPatents, agents[i].currentPatentsEnd(), held);
+    }
+
+    bool missingIntersects(int i, const PatentWord* patents) const {
+        const Agent& agent = agents[i];
+        return windowIntersects(agent.missingPatents, agent.targetFirstWord, agent.targetEndWord, patents);
+    }
+
+    int missingPatentAt(int i, int rank) const {
+        const Agent& agent = agents[i];
+        return windowPatentAtRank(agent.missingPatents, agent.targetFirstWord, agent.targetEndWord, rank);
+    }
+
+    int missingCount(int i) const { return agents[i].missingCount; }
+
+    void appendCurrentPatents(int i, vector<int>& out) const {
+        appendHeldPatents(agents[i].currentPatents, agents[i].currentPatentsEnd(), out);
+    }
+
+    bool exchange(int i, int j, ExchangeRecord* record = nullptr) {
+        return agents[i].exchangeWith(agents[j], record);
+    }
+};
+
+class AgentStore {
+public:
+    vector<int> ids;
+    vector<int> communicationRoundCounts;
+    vector<int> completionSteps;
+    vector<int> missingCounts;
+    vector<int> targetFirstWords;
+    vector<int> targetEndWords;
+    vector<size_t> targetOffsets;
+    vector<int> targetCounts;
+    vector<size_t> heldOffsets;
+    vector<int> heldCounts;
+    vector<size_t> missingOffsets;
+    vector<int> targetIds;
+    vector<HeldWord> heldWords;
+    vector<PatentWord> missingWords;
+    InitialHoldings initialHoldings;
+    bool holdingsReserved = false;
+
+    void create(int count) {
+        ids.resize(count);
+        for (int i = 0; i < count; i++) ids[i] = i;
+        communicationRoundCounts.assign(count, 0);
+        completionSteps.assign(count, 0);
+        missingCounts.assign(count, 0);
+        targetFirstWords.assign(count, 0);
+        targetEndWords.assign(count, 0);
+        targetOffsets.assign(count, 0);
+        targetCounts.assign(count, 0);
+        heldOffsets.assign(count + 1, 0);
+        heldCounts.assign(count, 0);
+        missingOffsets.assign(count, 0);
+        targetIds.clear();
+        heldWords.clear();
+        missingWords.clear();
+        initialHoldings.clear();
+        holdingsReserved = false;
+    }
+
+    const int* targetPatents(int i) const { return targetIds.data() + targetOffsets[i]; }
+    HeldWord* currentPatents(int i) { return heldWords.data() + heldOffsets[i]; }
+    const HeldWord* currentPatents(int i) const { return heldWords.data() + heldOffsets[i]; }
+    const HeldWord* currentPatentsEnd(int i) const { return currentPatents(i) + heldCounts[i]; }
+    PatentWord* missingPatents(int i) { return missingWords.data() + missingOffsets[i]; }
+    const PatentWord* missingPatents(int i) const { return missingWords.data() + missingOffsets[i]; }
+
+    int size() const { return static_cast<int>(ids.size()); }
+    int id(int i) const { return ids[i]; }
+    int targetCount(int i) const { return targetCounts[i]; }
+    int communicationRounds(int i) const { return communicationRoundCounts[i]; }
+    void setCommunicationRounds(int i, int rounds) { communicationRoundCounts[i] = rounds; }
+    int completionStep(int i) const { return completionSteps[i]; }
+    void setCompletionStep(int i, int step) { completionSteps[i] = step; }
+    bool isComplete(int i) const { return missingCounts[i] == 0; }
+
+    void addTargetPatent(int i, int patentId) {
+        if (targetCounts[i] == 0) targetOffsets[i] = targetIds.size();
+        assert(targetOffsets[i] + targetCounts[i] == targetIds.size());
+        targetIds.push_back(patentId);
+        targetCounts[i]++;
+    }
+
+    void appendTargetPatents(int i, vector<int>& out) const {
+        out.insert(out.end(), targetPatents(i), targetPatents(i) + targetCounts[i]);
+    }
+
+    void giveInitialPatent(int i, int patentId) { initialHoldings.add(i, patentId); }
+
+    template <class Engine>
+    void dealTargetPatents(Engine& engine) {
+        for (int i = 0; i < size(); i++) initialHoldings.addDealt(targetPatents(i), targetPatents(i) + targetCounts[i]);
+        initialHoldings.shuffleDealt(engine);
+    }
+
+    void reserveHoldings(const vector<int>& initialWords) {
+        int count = size();
+        size_t heldTotal = 0, missingTotal = 0;
+        for (int i = 0; i < count; i++) {
+            int* target = targetIds.data() + targetOffsets[i];
+            targetCounts[i] = sortPatentIds(target, target + targetCounts[i]);
+            targetFirstWords[i] = targetCounts[i] ? target[0] / PATENT_WORD_BITS : 0;
+            targetEndWords[i] = targetCounts[i] ? target[targetCounts[i] - 1] / PATENT_WORD_BITS + 1 : 0;
+            heldOffsets[i] = heldTotal;
+            heldCounts[i] = 0;
+            heldTotal += initialWords[i] + (targetEndWords[i] - targetFirstWords[i]);
+            missingOffsets[i] = missingTotal;
+            missingTotal += targetEndWords[i] - targetFirstWords[i];
+        }
+        heldOffsets[count] = heldTotal;
+        heldWords.resize(heldTotal);
+        missingWords.assign(missingTotal, 0);
+        holdingsReserved = true;
+    }
+
+    void holdInitialPatent(int i, int patentId) {
+        int index = patentId / PATENT_WORD_BITS;
+        HeldWord* held = currentPatents(i);
+        int& heldCount = heldCounts[i];
+        if (heldCount == 0 || held[heldCount - 1].index != index) {
+            assert(heldOffsets[i] + heldCount < heldOffsets[i + 1] && (heldCount == 0 || held[heldCount - 1].index < index));
+            held[heldCount++] = { index, 0 };
+        }
+        held[heldCount - 1].bits |= PatentWord(1) << (patentId % PATENT_WORD_BITS);
+    }
+
+    void finishSetup() {
+        int count = size();
+        if (!holdingsReserved) {
+            initialHoldings.bucket(count);
+            reserveHoldings(initialHoldings.wordCounts());
+            for (int i = 0; i < count; i++) {
+                for (const int* patent = initialHoldings.begin(i); patent != initialHoldings.end(i); ++patent) holdInitialPatent(i, *patent);
+            }
+        }
+        for (int i = 0; i < count; i++) {
+            buildMissingWindow(missingPatents(i), targetFirstWords[i], targetEndWords[i], targetPatents(i), targetPatents(i) + targetCounts[i],
+                currentPatents(i), currentPatentsEnd(i));
+            missingCounts[i] = countPatentBits(missingPatents(i), 0, targetEndWords[i] - targetFirstWords[i]);
+        }
+    }
+
+    void acquirePatent(int i, int patentId) {
+        int index = patentId / PATENT_WORD_BITS;
+        HeldWord* held = currentPatents(i);
+        HeldWord* end = held + heldCounts[i];
+        HeldWord* at = findHeldWord(held, end, index);
+        if (at == end || at->index != index) {
+            assert(heldOffsets[i] + heldCounts[i] < heldOffsets[i + 1]);
+            copy_backward(at, end, end + 1);
+            *at = { index, 0 };
+            heldCounts[i]++;
+        }
+        at->bits |= PatentWord(1) << (patentId % PATENT_WORD_BITS);
+        if (windowContains(missingPatents(i), targetFirstWords[i], targetEndWords[i], patentId)) {
+            clearPatentBit(missingPatents(i), patentId - targetFirstWords[i] * PATENT_WORD_BITS);
+            missingCounts[i]--;
+        }
+#ifdef LAB2_VERIFY_MISSING
+        assert(missingPatentsConsistent(i));
+#endif
+    }
+
+    bool missingPatentsConsistent(int i) const {
+        int wordCount = targetEndWords[i] - targetFirstWords[i];
+        vector<PatentWord> expected(wordCount, 0);
+        buildMissingWindow(expected.data(), targetFirstWords[i], targetEndWords[i], targetPatents(i), targetPatents(i) + targetCounts[i],
+            currentPatents(i), currentPatentsEnd(i));
+        return equal(expected.begin(), expected.end(), missingPatents(i))
+            && countPatentBits(expected.data(), 0, wordCount) == missingCounts[i];
+    }
+
+    int findNeededPatent(int i, int j) const {
+        return findFirstMissingHeld(missingPatents(i), targetFirstWords[i], targetEndWords[i], currentPatents(j), currentPatentsEnd(j));
+    }
+
+    int findGiveablePatent(int i, int j) const {
+        return findFirstMissingHeld(missingPatents(j), targetFirstWords[j], targetEndWords[j], currentPatents(i), currentPatentsEnd(i));
+    }
+
+    int countNeededPatents(int i, int j) const {
+        return countMissingHeld(missingPatents(i), targetFirstWords[i], targetEndWords[i], currentPatents(j), currentPatentsEnd(j));
+    }
+
+    template <class F>
+    void forEachMissingPatent(int i, F f) const {
+        forEachWindowPatent(missingPatents(i), targetFirstWords[i], targetEndWords[i], f);
+    }
+
+    void accumulateHeldPatents(int i, PatentWord* held) const {
+        accumulateHeldWords(currentPatents(i), currentPatentsEnd(i), held);
+    }
+
+    bool missingIntersects(int i, const PatentWord* patents) const {
+        return windowIntersects(missingPatents(i), targetFirstWords[i], targetEndWords[i], patents);
+    }
+
+    int missingPatentAt(int i, int rank) const {
+        return windowPatentAtRank(missingPatents(i), targetFirstWords[i], targetEndWords[i], rank);
+    }
+
+    int missingCount(int i) const { return missingCounts[i]; }
+
+    void appendCurrentPatents(int i, vector<int>& out) const {
+        appendHeldPatents(currentPatents(i), currentPatentsEnd(i), out);
+    }
+
+    bool exchange(int i, int j, ExchangeRecord* record = nullptr) {
+        communicationRoundCounts[i]++;
+        communicationRoundCounts[j]++;
+
+        int needed = findNeededPatent(i, j);
+        if (needed == -1) return false;
+
+        int giveToOther = findGiveablePatent(i, j);
+
+        acquirePatent(i, needed);
+
+        if (giveToOther != -1) {
+            acquirePatent(j, giveToOther);
+        }
+
+        if (record) {
+            record->received = needed;
+            record->given = giveToOther;
+        }
+        return true;
+    }
+};
+
+class SetAgent {
+public:
+    int id;
+    set<int> targetPatents;
+    set<int> currentPatents;
+    set<int> missingPatents;
+    int communicationRounds = 0;
+    int completionStep = 0;
+
+    explicit SetAgent(int agentId) : id(agentId) {}
+
+    void updateMissingPatents() {
+        missingPatents.clear();
+        for (int patentId : targetPatents) {
+            if (currentPatents.find(patentId) == currentPatents.end()) missingPatents.insert(patentId);
+        }
+    }
+
+    void acquirePatent(int patentId) {
+        currentPatents.insert(patentId);
+        updateMissingPatents();
+    }
+
+    int findNeededPatent(const SetAgent& other) const {
+        for (int patentId : missingPatents) {
+            if (other.currentPatents.find(patentId) != other.currentPatents.end()) return patentId;
+        }
+        return -1;
+    }
+
+    int findGiveablePatent(const SetAgent& other) const {
+        for (int patentId : currentPatents) {
+            if (other.missingPatents.find(patentId) != other.missingPatents.end()) return patentId;
+        }
+        if (!other.missingPatents.empty()) {
+            for (int patentId : currentPatents) {
+                if (targetPatents.find(patentId) == targetPatents.end()
+                    && other.missingPatents.find(patentId) != other.missingPatents.end()) return patentId;
+            }
+        }
+        return -1;
+    }
+};
+
+class SetAgentList {
+public:
+    vector<SetAgent> agents;
+
+    void create(int count) {
+        agents.clear();
+        agents.reserve(count);
+        for (int i = 0; i < count; i++) agents.emplace_back(i);
+    }
+
+    int size() const { return static_cast<int>(agents.size()); }
+    int id(int i) const { return agents[i].id; }
+    int targetCount(int i) const { return static_cast<int>(agents[i].targetPatents.size()); }
+    int communicationRounds(int i) const { return agents[i].communicationRounds; }
+    void setCommunicationRounds(int i, int rounds) { agents[i].communicationRounds = rounds; }
+    int completionStep(int i) const { return agents[i].completionStep; }
+    void setCompletionStep(int i, int step) { agents[i].completionStep = step; }
+    bool isComplete(int i) const { return agents[i].missingPatents.empty(); }
+
+    void addTargetPatent(int i, int patentId) { agents[i].targetPatents.insert(patentId); }
+
+    void appendTargetPatents(int i, vector<int>& out) const {
+        out.insert(out.end(), agents[i].targetPatents.begin(), agents[i].targetPatents.end());
+    }
+
+    void giveInitialPatent(int i, int patentId) { agents[i].currentPatents.insert(patentId); }
+
+    void reserveHoldings(const vector<int>&) {}
+
+    void holdInitialPatent(int i, int patentId) { agents[i].currentPatents.insert(agents[i].currentPatents.end(), patentId); }
+
+    template <class Engine>
+    void dealTargetPatents(Engine& engine) {
+        vector<int> allPatents;
+        for (const SetAgent& agent : agents) allPatents.insert(allPatents.end(), agent.targetPatents.begin(), agent.targetPatents.end());
+        shuffle(allPatents.begin(), allPatents.end(), engine);
+        for (size_t k = 0; k < allPatents.size(); k++) giveInitialPatent(static_cast<int>(k % agents.size()), allPatents[k]);
+    }
+
+    void finishSetup() {
+        for (auto& agent : agents) agent.updateMissingPatents();
+    }
+
+    int findNeededPatent(int i, int j) const {
+        return agents[i].findNeededPatent(agents[j]);
+    }
+
+    int findGiveablePatent(int i, int j) const {
+        return agents[i].findGiveablePatent(agents[j]);
+    }
+
+    int countNeededPatents(int i, int j) const {
+        const set<int>& held = agents[j].currentPatents;
+        int total = 0;
+        for (int patentId : agents[i].missingPatents) total += static_cast<int>(held.count(patentId));
+        return total;
+    }
+
+    template <class F>
+    void forEachMissingPatent(int i, F f) const {
+        for (int patentId : agents[i].missingPatents) f(patentId);
+    }
+
+    void accumulateHeldPatents(int i, PatentWord* held) const {
+        for (int patentId : agents[i].currentPatents) setPatentBit(held, patentId);
+    }
+
+    bool missingIntersects(int i, const PatentWord* patents) const {
+        for (int patentId : agents[i].missingPatents) {
+            if (testPatentBit(patents, patentId)) return true;
+        }
+        return false;
+    }
+
+    int missingPatentAt(int i, int rank) const {
+        const set<int>& missing = agents[i].missingPatents;
+        if (rank < 0 || rank >= static_cast<int>(missing.size())) return -1;
+        return *next(missing.begin(), rank);
+    }
+
+    int missingCount(int i) const { return static_cast<int>(agents[i].missingPatents.size()); }
+
+    void appendCurrentPatents(int i, vector<int>& out) const {
+        out.insert(out.end(), agents[i].currentPatents.begin(), agents[i].currentPatents.end());
+    }
+
+    bool exchange(int i, int j, ExchangeRecord* record = nullptr) {
+        SetAgent& agent = agents[i];
+        SetAgent& other = agents[j];
+        agent.communicationRounds++;
+        other.communicationRounds++;
+
+        int needed = agent.findNeededPatent(other);
+        if (needed == -1) return false;
+
+        int giveToOther = agent.findGiveablePatent(other);
+
+        agent.acquirePatent(needed);
+
+        if (giveToOther != -1) {
+            other.acquirePatent(giveToOther);
+        }
+
+        if (record) {
+            record->received = needed;
+            record->given = giveToOther;
+        }
+        return true;
+    }
+};
+
+class ActiveSet {
+public:
+    vector<int> members;
+    vector<int> positions;
+
+    void reset(int count) {
+        members.clear();
+        members.reserve(count);
+        positions.assign(count, -1);
+    }
+
+    void insert(int i) {
+        if (positions[i] != -1) return;
+        positions[i] = static_cast<int>(members.size());
+        members.push_back(i);
+    }
+
+    bool erase(int i) {
+        int position = positions[i];
+        if (position == -1) return false;
+        int last = members.back();
+        members[position] = last;
+        positions[last] = position;
+        members.pop_back();
+        positions[i] = -1;
+        return true;
+    }
+
+    bool contains(int i) const { return positions[i] != -1; }
+    int size() const { return static_cast<int>(members.size()); }
+    bool empty() const { return members.empty(); }
+};
+
+class ThreadPool {
+public:
+    explicit ThreadPool(int threadCount) {
+        for (int t = 1; t < threadCount; t++) {
+            workers.emplace_back([this] { workerLoop(); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            lock_guard<mutex> lock(mtx);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers) worker.join();
+    }
+
+    int size() const {
+        return static_cast<int>(workers.size()) + 1;
+    }
+
+    void parallelFor(int count, const function<void(int)>& task) {
+        {
+            lock_guard<mutex> lock(mtx);
+            currentTask = &task;
+            taskCount = count;
+            nextTask = 0;
+            busyWorkers = static_cast<int>(workers.size());
+            generation++;
+        }
+        wake.notify_all();
+        runTasks(task, count);
+
+        unique_lock<mutex> lock(mtx);
+        done.wait(lock, [this] { return busyWorkers == 0; });
+        currentTask = nullptr;
+    }
+
+private:
+    vector<thread> workers;
+    mutex mtx;
+    condition_variable wake;
+    condition_variable done;
+    const function<void(int)>* currentTask = nullptr;
+    int taskCount = 0;
+    atomic<int> nextTask{ 0 };
+    int busyWorkers = 0;
+    unsigned long long generation = 0;
+    bool stopping = false;
+
+    void runTasks(const function<void(int)>& task, int count) {
+        for (int k = nextTask++; k < count; k = nextTask++) {
+            task(k);
+        }
+    }
+
+    void workerLoop() {
+        unsigned long long seenGeneration = 0;
+        while (true) {
+            const function<void(int)>* task;
+            int count;
+            {
+                unique_lock<mutex> lock(mtx);
+                wake.wait(lock, [&] { return stopping || generation != seenGeneration; });
+                if (stopping) return;
+                seenGeneration = generation;
+                task = currentTask;
+                count = taskCount;
+            }
+            runTasks(*task, count);
+            {
+                lock_guard<mutex> lock(mtx);
+                busyWorkers--;
+            }
+            done.notify_one();
+        }
+    }
+};
+
+class IntHistogram {
+public:
+    vector<long long> counts;
+    long long total = 0;
+    long long sum = 0;
+
+    void add(int value) {
+        if (value >= static_cast<int>(counts.size())) counts.resize(value + 1, 0);
+        counts[value]++;
+        total++;
+        sum += value;
+    }
+
+    void clear() {
+        counts.clear();
+        total = 0;
+        sum = 0;
+    }
+
+    void add(int value, long long count) {
+        if (value >= static_cast<int>(counts.size())) counts.resize(value + 1, 0);
+        counts[value] += count;
+        total += count;
+        sum += static_cast<long long>(value) * count;
+    }
+
+    void merge(const IntHistogram& other) {
+        if (other.counts.size() > counts.size()) counts.resize(other.counts.size(), 0);
+        for (size_t value = 0; value < other.counts.size(); value++) counts[value] += other.counts[value];
+        total += other.total;
+        sum += other.sum;
+    }
+
+    double mean() const {
+        return total ? static_cast<double>(sum) / total : 0.0;
+    }
+
+    int percentile(double q) const {
+        long long rank = max(1LL, static_cast<long long>(ceil(q * total)));
+        long long seen = 0;
+        for (size_t value = 0; value < counts.size(); value++) {
+            seen += counts[value];
+            if (seen >= rank) return static_cast<int>(value);
+        }
+        return 0;
+    }
+};
+
+inline unsigned long long splitMix64(unsigned long long value) {
+    value += 0x9E3779B97F4A7C15ULL;
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+    return value ^ (value >> 31);
+}
+
+class Xoshiro256StarStar {
+public:
+    using result_type = unsigned long long;
+
+    explicit Xoshiro256StarStar(unsigned long long seedValue = 0) {
+        seed(seedValue);
+    }
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return ~result_type(0); }
+
+    void seed(unsigned long long seedValue) {
+        for (auto& word : state) {
+            seedValue += 0x9E3779B97F4A7C15ULL;
+            word = splitMix64(seedValue);
+        }
+    }
+
+    static Xoshiro256StarStar forStream(unsigned long long masterSeed, unsigned long long stream) {
+        return Xoshiro256StarStar(masterSeed ^ splitMix64(stream));
+    }
+
+    friend ostream& operator<<(ostream& out, const Xoshiro256StarStar& engine) {
+        return out << engine.state[0] << ' ' << engine.state[1] << ' ' << engine.state[2] << ' ' << engine.state[3];
+    }
+
+    friend istream& operator>>(istream& in, Xoshiro256StarStar& engine) {
+        return in >> engine.state[0] >> engine.state[1] >> engine.state[2] >> engine.state[3];
+    }
+
+    result_type operator()() {
+        result_type result = rotl(state[1] * 5, 7) * 9;
+        result_type t = state[1] << 17;
+        state[2] ^= state[0];
+        state[3] ^= state[1];
+        state[1] ^= state[2];
+        state[0] ^= state[3];
+        state[2] ^= t;
+        state[3] = rotl(state[3], 45);
+        return result;
+    }
+
+private:
+    result_type state[4];
+
+    static result_type rotl(result_type x, int k) {
+        return (x << k) | (x >> (64 - k));
+    }
+};
+
+template <class Engine>
+void seedEngine(Engine& engine, unsigned long long value) {
+    seed_seq sequence{ static_cast<unsigned>(value), static_cast<unsigned>(value >> 32) };
+    engine.seed(sequence);
+}
+
+inline void seedEngine(Xoshiro256StarStar& engine, unsigned long long value) {
+    engine.seed(value);
+}
+
+template <class Engine>
+Engine streamEngine(unsigned long long seed, unsigned long long stream) {
+    seed_seq sequence{ static_cast<unsigned>(seed), static_cast<unsigned>(stream) };
+    return Engine(sequence);
+}
+
+template <>
+inline Xoshiro256StarStar streamEngine<Xoshiro256StarStar>(unsigned long long seed, unsigned long long stream) {
+    return Xoshiro256StarStar::forStream(seed, stream);
+}
+
+struct IterationStats {
+    int iteration = 0;
+    int activeAgents = 0;
+    long long exchangesAttempted = 0;
+    long long exchangesSucceeded = 0;
+    int newlyCompleted = 0;
+};
+
+class TelemetryWriter {
+public:
+    explicit TelemetryWriter(const string& path) : out(path, ios::binary) {
+        buffer.reserve(BUFFER_LIMIT + 256);
+        buffer += "iteration;activeAgents;exchangesAttempted;exchangesSucceeded;newlyCompleted\n";
+    }
+
+    ~TelemetryWriter() {
+        flush();
+    }
+
+    bool isOpen() const {
+        return out.is_open();
+    }
+
+    void record(const IterationStats& stats) {
+        buffer += to_string(stats.iteration);
+        buffer += ';';
+        buffer += to_string(stats.activeAgents);
+        buffer += ';';
+        buffer += to_string(stats.exchangesAttempted);
+        buffer += ';';
+        buffer += to_string(stats.exchangesSucceeded);
+        buffer += ';';
+        buffer += to_string(stats.newlyCompleted);
+        buffer += '\n';
+        if (buffer.size() >= BUFFER_LIMIT) flush();
+    }
+
+    void flush() {
+        out.write(buffer.data(), static_cast<streamsize>(buffer.size()));
+        out.flush();
+        buffer.clear();
+    }
+
+private:
+    static const size_t BUFFER_LIMIT = 1 << 16;
+    ofstream out;
+    string buffer;
+};
+
+enum class AgentLayout { ArrayOfStructs, StructOfArrays, OrderedSets };
+
+class HolderIndex {
+public:
+    vector<vector<int>> holders;
+
+    void reset(int patentSpace) {
+        if (static_cast<int>(holders.size()) > patentSpace) holders.resize(patentSpace);
+        for (auto& list : holders) list.clear();
+        holders.resize(patentSpace);
+    }
+
+    void add(int patentId, int agent) {
+        holders[patentId].push_back(agent);
+    }
+
+    const vector<int>& holdersOf(int patentId) const {
+        return holders[patentId];
+    }
+};
+
+enum class PartnerSampling { Uniform, Useful, Informed };
+
+inline const char* partnerSamplingName(PartnerSampling sampling) {
+    switch (sampling) {
+    case PartnerSampling::Useful: return "useful";
+    case PartnerSampling::Informed: return "informed";
+    default: return "uniform";
+    }
+}
+
+inline PartnerSampling parsePartnerSampling(const string& name) {
+    if (name == "useful") return PartnerSampling::Useful;
+    if (name == "informed") return PartnerSampling::Informed;
+    return PartnerSampling::Uniform;
+}
+
+struct ScenarioSpec {
+    int agentCount = 0;
+    int patentSpace = 0;
+    int targetsPerAgent = 0;
+    double targetSpread = 1.0;
+    double holdingExponent = 0.0;
+};
+
+class AliasTable {
+public:
+    void build(const vector<double>& weights) {
+        int count = static_cast<int>(weights.size());
+        double total = 0.0;
+        for (double weight : weights) total += weight;
+        probability.assign(count, 1.0);
+        alias.resize(count);
+        vector<int> small, large;
+        vector<double> scaled(count);
+        for (int k = 0; k < count; k++) {
+            alias[k] = k;
+            scaled[k] = weights[k] * count / total;
+            (scaled[k] < 1.0 ? small : large).push_back(k);
+        }
+        while (!small.empty() && !large.empty()) {
+            int low = small.back(), high = large.back();
+            small.pop_back();
+            probability[low] = scaled[low];
+            alias[low] = high;
+            scaled[high] -= 1.0 - scaled[low];
+            if (scaled[high] < 1.0) {
+                large.pop_back();
+                small.push_back(high);
+            }
+        }
+    }
+
+    template <class Engine>
+    int sample(Engine& engine) const {
+        int k = uniform_int_distribution<int>(0, static_cast<int>(alias.size()) - 1)(engine);
+        return uniform_real_distribution<double>(0.0, 1.0)(engine) < probability[k] ? k : alias[k];
+    }
+
+private:
+    vector<double> probability;
+    vector<int> alias;
+};
+
+class ScenarioGenerator {
+public:
+    explicit ScenarioGenerator(const ScenarioSpec& scenario) : spec(scenario) {}
+
+    template <class Agents, class Engine>
+    void build(Agents& agents, Engine& engine) {
+        assignTargets(agents, engine);
+        dealHoldings(agents, engine);
+        agents.finishSetup();
+    }
+
+private:
+    ScenarioSpec spec;
+
+    template <class Agents, class Engine>
+    void assignTargets(Agents& agents, Engine& engine) {
+        int window = static_cast<int>(min<double>(spec.patentSpace, ceil(spec.targetsPerAgent * max(1.0, spec.targetSpread))));
+        double keep = static_cast<double>(spec.targetsPerAgent) / max(1, window);
+        uniform_real_distribution<double> coin(0.0, 1.0);
+        for (int i = 0; i < spec.agentCount; i++) {
+            long long start = static_cast<long long>(spec.patentSpace - window) * i / max(1, spec.agentCount - 1);
+            for (int patentId = static_cast<int>(start); patentId < start + window; patentId++) {
+                if (keep >= 1.0 || coin(engine) < keep) agents.addTargetPatent(i, patentId);
+            }
+        }
+    }
+
+    template <class Agents, class Engine>
+    void dealHoldings(Agents& agents, Engine& engine) {
+        vector<int> holderByRank(spec.agentCount);
+        vector<double> weights(spec.agentCount);
+        for (int k = 0; k < spec.agentCount; k++) {
+            holderByRank[k] = k;
+            weights[k] = pow(k + 1.0, -spec.holdingExponent);
+        }
+        shuffle(holderByRank.begin(), holderByRank.end(), engine);
+        AliasTable holders;
+        holders.build(weights);
+        Engine replay = engine;
+        vector<int> words(spec.agentCount, 0), lastWord(spec.agentCount, -1);
+        for (int patentId = 0; patentId < spec.patentSpace; patentId++) {
+            int holder = holderByRank[holders.sample(engine)];
+            if (lastWord[holder] != patentId / PATENT_WORD_BITS) words[holder]++;
+            lastWord[holder] = patentId / PATENT_WORD_BITS;
+        }
+        agents.reserveHoldings(words);
+        for (int patentId = 0; patentId < spec.patentSpace; patentId++) {
+            agents.holdInitialPatent(holderByRank[holders.sample(replay)], patentId);
+        }
+    }
+};
+
+class MappedFile {
+public:
+    ~MappedFile() {
+#ifdef LAB2_MMAP
+        if (mapped) munmap(const_cast<char*>(bytes), length);
+#endif
+    }
+
+    bool open(const string& path) {
+#ifdef LAB2_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd >= 0) {
+            struct stat info;
+            if (fstat(fd, &info) == 0 && info.st_size > 0) {
+                void* view = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+                if (view != MAP_FAILED) {
+                    bytes = static_cast<const char*>(view);
+                    length = static_cast<size_t>(info.st_size);
+                    mapped = true;
+                }
+            }
+            ::close(fd);
+            if (mapped) return true;
+        }
+#endif
+        ifstream in(path, ios::binary);
+        if (!in) return false;
+        fallback.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+        bytes = fallback.data();
+        length = fallback.size();
+        return true;
+    }
+
+    const char* data() const { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    const char* bytes = nullptr;
+    size_t length = 0;
+    bool mapped = false;
+    vector<char> fallback;
+};
+
+class ScenarioFile {
+public:
+    struct Header {
+        char magic[4];
+        uint32_t version;
+        int32_t agentCount;
+        int32_t patentSpace;
+    };
+
+    struct AgentRecord {
+        int32_t targetCount;
+        int32_t heldCount;
+    };
+
+    template <class Agents>
+    static bool save(const string& path, const Agents& agents, int patentSpace) {
+        ofstream out(path, ios::binary);
+        Header header = { { 'L', '2', 'S', 'C' }, VERSION, agents.size(), patentSpace };
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        vector<AgentRecord> records(agents.size());
+        vector<int> ids;
+        for (int i = 0; i < agents.size(); i++) {
+            size_t before = ids.size();
+            agents.appendTargetPatents(i, ids);
+            size_t targets = ids.size() - before;
+            agents.appendCurrentPatents(i, ids);
+            records[i] = { static_cast<int32_t>(targets), static_cast<int32_t>(ids.size() - before - targets) };
+        }
+        out.write(reinterpret_cast<const char*>(records.data()), static_cast<streamsize>(records.size() * sizeof(AgentRecord)));
+        out.write(reinterpret_cast<const char*>(ids.data()), static_cast<streamsize>(ids.size() * sizeof(int32_t)));
+        return static_cast<bool>(out);
+    }
+
+    static bool readHeader(const MappedFile& file, Header& header) {
+        if (file.size() < sizeof(Header)) return false;
+        memcpy(&header, file.data(), sizeof(Header));
+        if (memcmp(header.magic, "L2SC", 4) != 0 || header.version != VERSION
+            || header.agentCount < 0 || header.patentSpace < 0) return false;
+        size_t idBytes = file.size() - sizeof(Header);
+        if (idBytes / sizeof(AgentRecord) < static_cast<size_t>(header.agentCount)) return false;
+        idBytes -= static_cast<size_t>(header.agentCount) * sizeof(AgentRecord);
+
+        size_t idCount = 0;
+        for (int i = 0; i < header.agentCount; i++) {
+            AgentRecord record = recordAt(file, i);
+            if (record.targetCount < 0 || record.heldCount < 0) return false;
+            idCount += static_cast<size_t>(record.targetCount) + record.heldCount;
+        }
+        return idBytes == idCount * sizeof(int32_t);
+    }
+
+    template <class Agents>
+    static bool load(const MappedFile& file, Agents& agents, int patentSpace) {
+        const char* idsBegin = file.data() + sizeof(Header) + static_cast<size_t>(agents.size()) * sizeof(AgentRecord);
+        const char* ids = idsBegin;
+        vector<int> words(agents.size(), 0);
+        for (int i = 0; i < agents.size(); i++) {
+            AgentRecord record = recordAt(file, i);
+            int lastWord = -1;
+            if (!readIds(ids, record.targetCount, patentSpace, [&](int patentId) { agents.addTargetPatent(i, patentId); })
+                || !readIds(ids, record.heldCount, patentSpace, [&](int patentId) {
+                    if (patentId / PATENT_WORD_BITS != lastWord) words[i]++;
+                    lastWord = patentId / PATENT_WORD_BITS;
+                })) return false;
+        }
+
+        agents.reserveHoldings(words);
+        ids = idsBegin;
+        for (int i = 0; i < agents.size(); i++) {
+            AgentRecord record = recordAt(file, i);
+            ids += static_cast<size_t>(record.targetCount) * sizeof(int32_t);
+            readIds(ids, record.heldCount, patentSpace, [&](int patentId) { agents.holdInitialPatent(i, patentId); });
+        }
+        return true;
+    }
+
+private:
+    static const uint32_t VERSION = 2;
+
+    static AgentRecord recordAt(const MappedFile& file, int i) {
+        AgentRecord record;
+        memcpy(&record, file.data() + sizeof(Header) + static_cast<size_t>(i) * sizeof(AgentRecord), sizeof(record));
+        return record;
+    }
+
+    template <class Add>
+    static bool readIds(const char*& ids, int count, int patentSpace, Add add) {
+        int32_t previous = -1;
+        for (int k = 0; k < count; k++) {
+            int32_t patentId;
+            memcpy(&patentId, ids, sizeof(patentId));
+            ids += sizeof(patentId);
+            if (patentId <= previous || patentId >= patentSpace) return false;
+            add(patentId);
+            previous = patentId;
+        }
+        return true;
+    }
+};
+
+template <class T>
+void appendBytes(vector<char>& bytes, const T& value) {
+    const char* raw = reinterpret_cast<const char*>(&value);
+    bytes.insert(bytes.end(), raw, raw + sizeof(T));
+}
+
+class ByteReader {
+public:
+    ByteReader(const char* bytes, size_t length) : data(bytes), size(length) {}
+
+    template <class T>
+    bool read(T& value) {
+        return readBytes(&value, sizeof(T));
+    }
+
+    bool readBytes(void* out, size_t count) {
+        if (count > size - at) return false;
+        memcpy(out, data + at, count);
+        at += count;
+        return true;
+    }
+
+    bool finished() const { return at == size; }
+    size_t remaining() const { return size - at; }
+
+private:
+    const char* data;
+    size_t size;
+    size_t at = 0;
+};
+
+class CheckpointWriter {
+public:
+    explicit CheckpointWriter(const string& checkpointPath) : path(checkpointPath) {
+        writer = thread([this] { writeLoop(); });
+    }
+
+    ~CheckpointWriter() {
+        {
+            lock_guard<mutex> lock(mtx);
+            stopping = true;
+        }
+        wake.notify_all();
+        writer.join();
+    }
+
+    vector<char>& buffer() {
+        front.clear();
+        return front;
+    }
+
+    void submit() {
+        unique_lock<mutex> lock(mtx);
+        idle.wait(lock, [this] { return !pending; });
+        swap(front, back);
+        pending = true;
+        wake.notify_one();
+    }
+
+    bool ready() {
+        lock_guard<mutex> lock(mtx);
+        return !pending;
+    }
+
+    int written() {
+        lock_guard<mutex> lock(mtx);
+        return writtenCount;
+    }
+
+    bool failed() {
+        lock_guard<mutex> lock(mtx);
+        return writeFailed;
+    }
+
+private:
+    string path;
+    vector<char> front;
+    vector<char> back;
+    mutex mtx;
+    condition_variable wake;
+    condition_variable idle;
+    bool pending = false;
+    bool stopping = false;
+    bool writeFailed = false;
+    int writtenCount = 0;
+    thread writer;
+
+    void writeLoop() {
+        unique_lock<mutex> lock(mtx);
+        while (true) {
+            wake.wait(lock, [this] { return stopping || pending; });
+            if (!pending) return;
+            lock.unlock();
+            string temporary = path + ".tmp";
+            bool ok;
+            {
+                ofstream out(temporary, ios::binary);
+                out.write(back.data(), static_cast<streamsize>(back.size()));
+                ok = static_cast<bool>(out);
+            }
+            if (ok && rename(temporary.c_str(), path.c_str()) != 0) {
+                remove(path.c_str());
+                ok = rename(temporary.c_str(), path.c_str()) == 0;
+            }
+            lock.lock();
+            if (ok) writtenCount++;
+            else writeFailed = true;
+            pending = false;
+            idle.notify_all();
+        }
+    }
+};
+
+enum class IterationScheduler { Serial, ParallelRounds };
+enum class RunStatus { Completed, StepLimit, Deadlocked, Stalled };
+
+template <class Rng = mt19937>
+class Simulation {
+private:
+    AgentList agentList;
+    AgentStore agentStore;
+    SetAgentList setAgents;
+    AgentLayout layout;
+    PartnerSampling partnerSampling = PartnerSampling::Uniform;
+    IterationScheduler scheduler = IterationScheduler::Serial;
+    unique_ptr<ThreadPool> pool;
+    ActiveSet activeAgents;
+    vector<int> iterationOrder;
+    vector<int> proposedPartners;
+    vector<int> matchedInRound;
+    vector<int> deferredAgents;
+    vector<pair<int, int>> roundPairs;
+    vector<char> roundSucceeded;
+    vector<ExchangeRecord> roundRecords;
+    HolderIndex holderIndex;
+    vector<int> heldScratch;
+    int matchRound = 0;
+    IterationStats stats;
+    long long exchangesAttempted = 0;
+    TelemetryWriter* telemetry = nullptr;
+    CheckpointWriter* checkpoints = nullptr;
+    int checkpointInterval = 0;
+    int resumeIteration = 0;
+    bool printAgentResults = true;
+    int agentCount;
+    int patentsPerAgentTarget;
+    int patentSpace;
+    bool generateScenario = false;
+    ScenarioSpec scenario;
+    const int MAX_SIMULATION_STEPS = 10000;
+    const int ROUND_CHUNK_SIZE = 1024;
+    const int STALL_PROOF_INTERVAL = 32;
+    int stallWindow = 0;
+    int iterationsWithoutProgress = 0;
+    RunStatus runStatus = RunStatus::Completed;
+    vector<PatentWord> heldPatents;
+    Rng rng;
+
+public:
+    Simulation(int numAgents, int patentsPerAgent, AgentLayout agentLayout = AgentLayout::ArrayOfStructs)
+        : layout(agentLayout), agentCount(numAgents), patentsPerAgentTarget(patentsPerAgent),
+        patentSpace(numAgents * patentsPerAgent) {
+        rng.seed(random_device{}());
+    }
+
+    void reset(int numAgents, int patentsPerAgent) {
+        agentCount = numAgents;
+        patentsPerAgentTarget = patentsPerAgent;
+        patentSpace = numAgents * patentsPerAgent;
+        generateScenario = false;
+    }
+
+    void setScenario(const ScenarioSpec& spec) {
+        scenario = spec;
+        agentCount = spec.agentCount;
+        patentsPerAgentTarget = spec.targetsPerAgent;
+        patentSpace = spec.patentSpace;
+        generateScenario = true;
+    }
+
+    void seed(unsigned long long value) {
+        seedEngine(rng, value);
+    }
+
+    void initialize() {
+        withAgents([&](auto& agents) {
+            createAgents(agents);
+            if (generateScenario) {
+                ScenarioGenerator(scenario).build(agents, rng);
+            }
+            else {
+                assignTargetPatents(agents);
+                distributeInitialPatents(agents);
+            }
+            collectActiveAgents(agents);
+            if (usesHolderIndex()) buildHolderIndex(agents);
+        });
+    }
+
+    bool saveScenario(const string& path) {
+        bool saved = false;
+        withAgents([&](const auto& agents) { saved = ScenarioFile::save(path, agents, patentSpace); });
+        return saved;
+    }
+
+    bool loadScenario(const string& path) {
+        MappedFile file;
+        ScenarioFile::Header header;
+        if (!file.open(path) || !ScenarioFile::readHeader(file, header)) return false;
+        agentCount = header.agentCount;
+        patentSpace = header.patentSpace;
+        generateScenario = false;
+
+        bool loaded = false;
+        withAgents([&](auto& agents) {
+            createAgents(agents);
+            loaded = ScenarioFile::load(file, agents, patentSpace);
+            if (!loaded) return;
+            agents.finishSetup();
+            collectActiveAgents(agents);
+            if (usesHolderIndex()) buildHolderIndex(agents);
+        });
+        return loaded;
+    }
+
+    void setPartnerSampling(PartnerSampling sampling) {
+        partnerSampling = sampling;
+    }
+
+    void setTelemetry(TelemetryWriter* writer) {
+        telemetry = writer;
+    }
+
+    void setStallWindow(int iterations) {
+        stallWindow = iterations;
+    }
+
+    void setCheckpoints(CheckpointWriter* writer, int everyIterations) {
+        checkpoints = writer;
+        checkpointInterval = max(1, everyIterations);
+    }
+
+    bool restoreCheckpoint(const string& path) {
+        MappedFile file;
+        if (!file.open(path)) return false;
+        ByteReader in(file.data(), file.size());
+        char magic[4];
+        uint32_t version = 0;
+        int32_t agents = 0, patents = 0, sampling = 0, iteration = 0, withoutProgress = 0, status = 0;
+        int64_t attempted = 0;
+        uint32_t rngLength = 0;
+        if (!in.readBytes(magic, 4) || memcmp(magic, "L2CK", 4) != 0 || !in.read(version) || version != CHECKPOINT_VERSION) return false;
+        if (!in.read(agents) || !in.read(patents) || !in.read(sampling) || !in.read(iteration) || !in.read(attempted)
+            || !in.read(withoutProgress) || !in.read(status) || !in.read(rngLength)) return false;
+        if (agents < 0 || patents < 0 || sampling != static_cast<int32_t>(partnerSampling)) return false;
+        if (rngLength > in.remaining()) return false;
+        string rngState(rngLength, '\0');
+        if (!in.readBytes(&rngState[0], rngLength)) return false;
+        istringstream rngStream(rngState);
+        if (!(rngStream >> rng) || !(rngStream >> ws).eof()) return false;
+        size_t minimumBytes = static_cast<size_t>(agents) * CHECKPOINT_AGENT_BYTES + sizeof(int32_t);
+        if (usesHolderIndex()) minimumBytes += static_cast<size_t>(patents) * sizeof(int32_t);
+        if (in.remaining() < minimumBytes) return false;
+
+        agentCount = agents;
+        patentSpace = patents;
+        generateScenario = false;
+        resumeIteration = iteration;
+        exchangesAttempted = attempted;
+        iterationsWithoutProgress = withoutProgress;
+        runStatus = static_cast<RunStatus>(status);
+
+        bool restored = false;
+        withAgents([&](auto& agentSet) {
+            createAgents(agentSet);
+            restored = readCheckpointState(in, agentSet);
+        });
+        return restored && in.finished();
+    }
+
+    void setResultsOutput(bool enabled) {
+        printAgentResults = enabled;
+    }
+
+    void useParallelRounds(int threadCount) {
+        scheduler = IterationScheduler::ParallelRounds;
+        pool = make_unique<ThreadPool>(max(1, threadCount));
+    }
+
+    template <class F>
+    void withAgents(F&& f) {
+        if (layout == AgentLayout::StructOfArrays) f(agentStore);
+        else if (layout == AgentLayout::OrderedSets) f(setAgents);
+        else f(agentList);
+    }
+
+private:
+
+    template <class Agents>
+    void createAgents(Agents& agents) {
+        agents.create(agentCount);
+    }
+
+    template <class Agents>
+    void assignTargetPatents(Agents& agents) {
+        int globalPatentId = 0;
+        for (int i = 0; i < agentCount; i++) {
+            for (int j = 0; j < patentsPerAgentTarget; j++) {
+                agents.addTargetPatent(i, globalPatentId++);
+            }
+        }
+    }
+
+    template <class Agents>
+    void distributeInitialPatents(Agents& agents) {
+        agents.dealTargetPatents(rng);
+        agents.finishSetup();
+    }
+
+    template <class Agents>
+    void buildHolderIndex(const Agents& agents) {
+        holderIndex.reset(patentSpace);
+        for (int i = 0; i < agentCount; i++) {
+            heldScratch.clear();
+            agents.appendCurrentPatents(i, heldScratch);
+            for (int patentId : heldScratch) holderIndex.add(patentId, i);
+        }
+    }
+
+    bool usesHolderIndex() const {
+        return partnerSampling != PartnerSampling::Uniform;
+    }
+
+    void recordExchange(int i, int j, const ExchangeRecord& record) {
+        if (!usesHolderIndex()) return;
+        holderIndex.add(record.received, i);
+        if (record.given != -1) holderIndex.add(record.given, j);
+    }
+
+    template <class Agents>
+    void collectActiveAgents(const Agents& agents) {
+        activeAgents.reset(agentCount);
+        for (int i = 0; i < agentCount; i++) {
+            if (!agents.isComplete(i)) activeAgents.insert(i);
+        }
+    }
+
+public:
+    void run() {
+        int iteration = execute();
+        if (printAgentResults) writeResults(cout, iteration);
+    }
+
+    void writeResults(ostream& out, int iteration) {
+        withAgents([&](const auto& agents) { printResults(out, agents, iteration); });
+    }
 
-    Agent(int agentId) : id(agentId) {}
+    int execute() {
+        return executeSteps(MAX_SIMULATION_STEPS);
+    }
 
-    void updateMissingPatents() {
-        missingPatents.clear();
-        for (int patentId : targetPatents) {
-            if (currentPatents.find(patentId) == currentPatents.end()) {
-                missingPatents.insert(patentId);
+    int executeSteps(int maxSteps) {
+        int iteration = resumeIteration;
+        if (resumeIteration == 0) {
+            exchangesAttempted = 0;
+            iterationsWithoutProgress = 0;
+        }
+        resumeIteration = 0;
+        withAgents([&](auto& agents) {
+            bool allAgentsComplete = false;
+            bool stopped = false;
+
+            while (!allAgentsComplete && !stopped && iteration < maxSteps) {
+                iteration++;
+                stats = IterationStats();
+                stats.iteration = iteration;
+                stats.activeAgents = activeAgents.size();
+                if (scheduler == IterationScheduler::ParallelRounds)
+                    allAgentsComplete = simulateRound(agents, iteration);
+                else
+                    allAgentsComplete = simulateIteration(agents, iteration);
+                exchangesAttempted += stats.exchangesAttempted;
+                if (telemetry) telemetry->record(stats);
+                if (!allAgentsComplete) stopped = detectStall(agents);
+                if (checkpoints && !allAgentsComplete && !stopped && iteration % checkpointInterval == 0 && checkpoints->ready()) {
+                    writeCheckpoint(agents, iteration);
+                }
+            }
+
+            if (!stopped) runStatus = allAgentsComplete ? RunStatus::Completed : RunStatus::StepLimit;
+        });
+        if (telemetry) telemetry->flush();
+        return iteration;
+    }
+
+    int completedAgents() const {
+        return agentCount - activeAgents.size();
+    }
+
+    RunStatus status() const {
+        return runStatus;
+    }
+
+    long long totalExchangesAttempted() const {
+        return exchangesAttempted;
+    }
+
+    void addCommunicationRounds(IntHistogram& histogram) {
+        withAgents([&](const auto& agents) {
+            for (int i = 0; i < agents.size(); i++) histogram.add(agents.communicationRounds(i));
+        });
+    }
+
+private:
+    static constexpr uint32_t CHECKPOINT_VERSION = 2;
+    static constexpr size_t CHECKPOINT_AGENT_BYTES = 4 * sizeof(int32_t);
+
+    template <class Agents>
+    void writeCheckpoint(const Agents& agents, int iteration) {
+        vector<char>& bytes = checkpoints->buffer();
+        bytes.insert(bytes.end(), { 'L', '2', 'C', 'K' });
+        appendBytes(bytes, CHECKPOINT_VERSION);
+        appendBytes(bytes, static_cast<int32_t>(agentCount));
+        appendBytes(bytes, static_cast<int32_t>(patentSpace));
+        appendBytes(bytes, static_cast<int32_t>(partnerSampling));
+        appendBytes(bytes, static_cast<int32_t>(iteration));
+        appendBytes(bytes, static_cast<int64_t>(exchangesAttempted));
+        appendBytes(bytes, static_cast<int32_t>(iterationsWithoutProgress));
+        appendBytes(bytes, static_cast<int32_t>(runStatus));
+        ostringstream rngStream;
+        rngStream << rng;
+        string rngState = rngStream.str();
+        appendBytes(bytes, static_cast<uint32_t>(rngState.size()));
+        bytes.insert(bytes.end(), rngState.begin(), rngState.end());
+
+        for (int i = 0; i < agentCount; i++) {
+            heldScratch.clear();
+            agents.appendTargetPatents(i, heldScratch);
+            int targetCount = static_cast<int>(heldScratch.size());
+            agents.appendCurrentPatents(i, heldScratch);
+            appendBytes(bytes, static_cast<int32_t>(agents.communicationRounds(i)));
+            appendBytes(bytes, static_cast<int32_t>(agents.completionStep(i)));
+            appendBytes(bytes, static_cast<int32_t>(targetCount));
+            appendBytes(bytes, static_cast<int32_t>(heldScratch.size() - targetCount));
+            const char* ids = reinterpret_cast<const char*>(heldScratch.data());
+            bytes.insert(bytes.end(), ids, ids + heldScratch.size() * sizeof(int));
+        }
+
+        appendBytes(bytes, static_cast<int32_t>(activeAgents.size()));
+        const char* members = reinterpret_cast<const char*>(activeAgents.members.data());
+        bytes.insert(bytes.end(), members, members + activeAgents.members.size() * sizeof(int));
+
+        if (usesHolderIndex()) {
+            for (int patentId = 0; patentId < patentSpace; patentId++) {
+                const vector<int>& holders = holderIndex.holdersOf(patentId);
+                appendBytes(bytes, static_cast<int32_t>(holders.size()));
+                const char* list = reinterpret_cast<const char*>(holders.data());
+                bytes.insert(bytes.end(), list, list + holders.size() * sizeof(int));
             }
         }
+        checkpoints->submit();
     }
 
-    bool isComplete() const {
-        return missingPatents.empty();
+    template <class Agents>
+    bool readCheckpointState(ByteReader& in, Agents& agents) {
+        for (int i = 0; i < agentCount; i++) {
+            int32_t rounds, completion, targetCount, heldCount;
+            if (!in.read(rounds) || !in.read(completion) || !in.read(targetCount) || !in.read(heldCount)) return false;
+            if (targetCount < 0 || heldCount < 0 || in.remaining() / sizeof(int32_t) < static_cast<size_t>(targetCount) + heldCount) return false;
+            if (!readPatentIds(in, targetCount, [&](int patentId) { agents.addTargetPatent(i, patentId); })
+                || !readPatentIds(in, heldCount, [&](int patentId) { agents.giveInitialPatent(i, patentId); })) return false;
+            agents.setCommunicationRounds(i, rounds);
+            agents.setCompletionStep(i, completion);
+        }
+        agents.finishSetup();
+
+        int32_t activeCount;
+        if (!in.read(activeCount) || activeCount < 0 || activeCount > agentCount) return false;
+        activeAgents.reset(agentCount);
+        for (int k = 0; k < activeCount; k++) {
+            int32_t i;
+            if (!in.read(i) || i < 0 || i >= agentCount) return false;
+            activeAgents.insert(i);
+        }
+
+        if (usesHolderIndex()) {
+            holderIndex.reset(patentSpace);
+            for (int patentId = 0; patentId < patentSpace; patentId++) {
+                int32_t count;
+                if (!in.read(count) || count < 0) return false;
+                for (int k = 0; k < count; k++) {
+                    int32_t holder;
+                    if (!in.read(holder) || holder < 0 || holder >= agentCount) return false;
+                    holderIndex.add(patentId, holder);
+                }
+            }
+        }
+        return true;
     }
 
-    int findNeededPatent(const Agent& other) const {
-        for (int patentId : missingPatents) {
-            if (other.currentPatents.find(patentId) != other.currentPatents.end())
-                return patentId;
+    template <class Add>
+    bool readPatentIds(ByteReader& in, int count, Add add) {
+        int32_t previous = -1;
+        for (int k = 0; k < count; k++) {
+            int32_t patentId;
+            if (!in.read(patentId) || patentId <= previous || patentId >= patentSpace) return false;
+            add(patentId);
+            previous = patentId;
         }
-        return -1;
+        return true;
     }
 
-    int findGiveablePatent(const Agent& other) const {
-        for (int patentId : currentPatents) {
-            if (other.missingPatents.find(patentId) != other.missingPatents.end()) {
-                return patentId;
+    template <class Agents>
+    bool detectStall(const Agents& agents) {
+        if (stats.exchangesSucceeded > 0) {
+            iterationsWithoutProgress = 0;
+            return false;
+        }
+
+        iterationsWithoutProgress++;
+        if (iterationsWithoutProgress % STALL_PROOF_INTERVAL == 0 && !anyAgentCanProgress(agents)) {
+            runStatus = RunStatus::Deadlocked;
+            return true;
+        }
+        if (stallWindow > 0 && iterationsWithoutProgress >= stallWindow) {
+            runStatus = RunStatus::Stalled;
+            return true;
+        }
+        return false;
+    }
+
+    template <class Agents>
+    bool anyAgentCanProgress(const Agents& agents) {
+        heldPatents.assign(patentWordsFor(patentSpace), 0);
+        for (int i = 0; i < agentCount; i++) {
+            agents.accumulateHeldPatents(i, heldPatents.data());
+        }
+        for (int i : activeAgents.members) {
+            if (agents.missingIntersects(i, heldPatents.data())) return true;
+        }
+        return false;
+    }
+
+    template <class Agents>
+    bool simulateIteration(Agents& agents, int iteration) {
+        bool allComplete = true;
+
+        iterationOrder.assign(activeAgents.members.begin(), activeAgents.members.end());
+        shuffle(iterationOrder.begin(), iterationOrder.end(), rng);
+
+        uniform_int_distribution<int> dist(0, agentCount - 1);
+        for (int i : iterationOrder) {
+            if (agents.isComplete(i)) continue;
+
+            allComplete = false;
+
+            int j = choosePartner(agents, i, dist, rng);
+            if (j == -1) continue;
+
+            stats.exchangesAttempted++;
+            ExchangeRecord record;
+            if (agents.exchange(i, j, &record)) {
+                recordExchange(i, j, record);
+                stats.exchangesSucceeded++;
+                if (agents.completionStep(i) == 0) agents.setCompletionStep(i, iteration);
             }
+
+            retireIfComplete(agents, i);
+            retireIfComplete(agents, j);
         }
 
-        if (!other.isComplete()) {
-            for (int patentId : currentPatents) {
-                if (targetPatents.find(patentId) == targetPatents.end() &&
-                    other.missingPatents.find(patentId) != other.missingPatents.end()) {
-                    return patentId;
+        return allComplete;
+    }
+
+    template <class Agents>
+    bool simulateRound(Agents& agents, int iteration) {
+        iterationOrder.assign(activeAgents.members.begin(), activeAgents.members.end());
+        if (iterationOrder.empty()) return true;
+        shuffle(iterationOrder.begin(), iterationOrder.end(), rng);
+
+        matchedInRound.resize(agentCount, 0);
+        while (!iterationOrder.empty()) {
+            matchRound++;
+            proposePartners(agents);
+            deferredAgents.clear();
+            roundPairs.clear();
+            for (size_t k = 0; k < iterationOrder.size(); k++) {
+                int i = iterationOrder[k];
+                int j = proposedPartners[k];
+                if (j == -1) continue;
+                if (matchedInRound[i] == matchRound || matchedInRound[j] == matchRound) {
+                    deferredAgents.push_back(i);
+                    continue;
                 }
+                matchedInRound[i] = matchRound;
+                matchedInRound[j] = matchRound;
+                roundPairs.emplace_back(i, j);
+            }
+
+            exchangeRoundPairs(agents, iteration);
+
+            iterationOrder.clear();
+            for (int i : deferredAgents) {
+                if (!agents.isComplete(i)) iterationOrder.push_back(i);
             }
         }
 
-        return -1;
+        return false;
     }
 
-    bool exchangeWith(Agent& other) {
-        communicationRounds++;
-        other.communicationRounds++;
+    template <class Agents>
+    void proposePartners(const Agents& agents) {
+        int count = static_cast<int>(iterationOrder.size());
+        unsigned long long roundSeed = rng();
+        proposedPartners.resize(count);
 
-        int needed = findNeededPatent(other);
-        if (needed == -1) return false;
+        pool->parallelFor((count + ROUND_CHUNK_SIZE - 1) / ROUND_CHUNK_SIZE, [&](int chunk) {
+            Rng chunkRng = streamEngine<Rng>(roundSeed, chunk);
+            uniform_int_distribution<int> dist(0, agentCount - 1);
+            int end = min(count, (chunk + 1) * ROUND_CHUNK_SIZE);
+            for (int k = chunk * ROUND_CHUNK_SIZE; k < end; k++) {
+                proposedPartners[k] = choosePartner(agents, iterationOrder[k], dist, chunkRng);
+            }
+        });
+    }
 
-        int giveToOther = findGiveablePatent(other);
+    template <class Agents>
+    void exchangeRoundPairs(Agents& agents, int iteration) {
+        int pairCount = static_cast<int>(roundPairs.size());
+        roundSucceeded.resize(pairCount);
+        roundRecords.resize(pairCount);
+        pool->parallelFor((pairCount + ROUND_CHUNK_SIZE - 1) / ROUND_CHUNK_SIZE, [&](int chunk) {
+            int end = min(pairCount, (chunk + 1) * ROUND_CHUNK_SIZE);
+            for (int k = chunk * ROUND_CHUNK_SIZE; k < end; k++) {
+                int i = roundPairs[k].first;
+                roundSucceeded[k] = agents.exchange(i, roundPairs[k].second, &roundRecords[k]);
+                if (roundSucceeded[k] && agents.completionStep(i) == 0) {
+                    agents.setCompletionStep(i, iteration);
+                }
+            }
+        });
 
-        currentPatents.insert(needed);
-        updateMissingPatents();
+        stats.exchangesAttempted += pairCount;
+        for (int k = 0; k < pairCount; k++) {
+            stats.exchangesSucceeded += roundSucceeded[k];
+            if (roundSucceeded[k]) recordExchange(roundPairs[k].first, roundPairs[k].second, roundRecords[k]);
+            retireIfComplete(agents, roundPairs[k].first);
+            retireIfComplete(agents, roundPairs[k].second);
+        }
+    }
 
-        if (giveToOther != -1) {
-            other.currentPatents.insert(giveToOther);
-            other.updateMissingPatents();
+    template <class Agents>
+    void retireIfComplete(const Agents& agents, int i) {
+        if (agents.isComplete(i) && activeAgents.erase(i)) stats.newlyCompleted++;
+    }
+
+    template <class Agents, class Engine>
+    int choosePartner(const Agents& agents, int i, uniform_int_distribution<int>& dist, Engine& engine) {
+        if (partnerSampling == PartnerSampling::Uniform) {
+            int j = dist(engine);
+            return j == i ? -1 : j;
         }
 
-        return true;
+        if (partnerSampling == PartnerSampling::Informed) {
+            int count = agents.missingCount(i);
+            if (count == 0) return -1;
+            int patentId = agents.missingPatentAt(i, uniform_int_distribution<int>(0, count - 1)(engine));
+            const vector<int>& holders = holderIndex.holdersOf(patentId);
+            if (holders.empty()) return -1;
+            return holders[uniform_int_distribution<int>(0, static_cast<int>(holders.size()) - 1)(engine)];
+        }
+
+        return chooseUsefulPartner(agents, i, engine);
+    }
+
+    template <class Agents, class Engine>
+    int chooseUsefulPartner(const Agents& agents, int i, Engine& engine) const {
+        long long weight = 0;
+        agents.forEachMissingPatent(i, [&](int patentId) { weight += static_cast<long long>(holderIndex.holdersOf(patentId).size()); });
+        if (weight == 0) return -1;
+
+        uniform_int_distribution<long long> slot(0, weight - 1);
+        while (true) {
+            long long offset = slot(engine);
+            int holder = -1;
+            agents.forEachMissingPatent(i, [&](int patentId) {
+                if (holder != -1) return;
+                const vector<int>& holders = holderIndex.holdersOf(patentId);
+                if (offset < static_cast<long long>(holders.size())) holder = holders[offset];
+                else offset -= static_cast<long long>(holders.size());
+            });
+            int shared = agents.countNeededPatents(i, holder);
+            if (shared == 1 || uniform_int_distribution<int>(0, shared - 1)(engine) == 0) return holder;
+        }
+    }
+
+    template <class Agents>
+    void printResults(ostream& out, const Agents& agents, int iteration) const {
+        const int AGENTS_PER_BATCH = 4096;
+        ostringstream report;
+        report << "=== Результаты моделирования ===\n";
+        for (int i = 0; i < agents.size(); i++) {
+            report << "Агент " << agents.id(i)
+                << " | Целевой набор: " << agents.targetCount(i)
+                << " | Итерации: " << agents.completionStep(i)
+                << " | Раунды коммуникаций: " << agents.communicationRounds(i) << '\n';
+            if ((i + 1) % AGENTS_PER_BATCH == 0) {
+                out << report.str();
+                report.str("");
+            }
+        }
+        out << report.str();
+
+        if (runStatus == RunStatus::Deadlocked)
+            out << "\nВнимание: Обмен зашёл в тупик на итерации " << iteration << ", прогресс невозможен.\n";
+        else if (runStatus == RunStatus::Stalled)
+            out << "\nВнимание: Нет прогресса " << iterationsWithoutProgress << " итераций, остановка на итерации " << iteration << ".\n";
+        else if (runStatus == RunStatus::StepLimit)
+            out << "\nВнимание: Достигнут лимит итераций.\n";
+        else
+            out << "\nСимуляция завершена за " << iteration << " итераций.\n";
     }
 };
 
-class Simulation {
-private:
-    vector<Agent> agentList;
+struct BatchConfig {
     int agentCount;
-    int patentsPerAgentTarget;
-    const int MAX_SIMULATION_STEPS = 10000;
-    mt19937 rng;
+    int patentsPerAgent;
+    PartnerSampling partnerSampling;
+    int seedGroup;
+};
+
+struct BatchSummary {
+    BatchConfig config;
+    IntHistogram iterations;
+    IntHistogram communicationRounds;
+    int stepLimitHits = 0;
+    int deadlocks = 0;
+    int stalls = 0;
+    long long completedAgents = 0;
+};
 
+class BatchRunner {
 public:
-    Simulation(int numAgents, int patentsPerAgent)
-        : agentCount(numAgents), patentsPerAgentTarget(patentsPerAgent) {
-        rng.seed(static_cast<unsigned>(time(nullptr)));
+    BatchRunner(vector<BatchConfig> configGrid, int replicaCount, unsigned long long seed, int threadCount)
+        : grid(move(configGrid)), replicas(replicaCount), masterSeed(seed), threads(max(1, threadCount)) {}
+
+    void setAgentLayout(AgentLayout agentLayout) { layout = agentLayout; }
+    void setStallWindow(int iterations) { stallWindow = iterations; }
+
+    void setShard(long long shardIndex, long long shardCount) {
+        long long taskCount = static_cast<long long>(grid.size()) * replicas;
+        firstTask = static_cast<int>(taskCount * shardIndex / shardCount);
+        lastTask = static_cast<int>(taskCount * (shardIndex + 1) / shardCount);
     }
 
-    void initialize() {
-        createAgents();
-        assignTargetPatents();
-        distributeInitialPatents();
+    template <class Rng = mt19937>
+    vector<BatchSummary> run() {
+        vector<BatchSummary> summaries(grid.size());
+        vector<mutex> summaryLocks(grid.size());
+        for (size_t c = 0; c < grid.size(); c++) summaries[c].config = grid[c];
+
+        int taskCount = lastTask < 0 ? static_cast<int>(grid.size()) * replicas : lastTask;
+        atomic<int> nextTask{ firstTask };
+        ThreadPool pool(threads);
+        pool.parallelFor(threads, [&](int) {
+            Simulation<Rng> sim(0, 0, layout);
+            sim.setStallWindow(stallWindow);
+            IntHistogram rounds;
+
+            for (int task = nextTask++; task < taskCount; task = nextTask++) {
+                int configIndex = task / replicas;
+                const BatchConfig& config = grid[configIndex];
+
+                sim.reset(config.agentCount, config.patentsPerAgent);
+                sim.setPartnerSampling(config.partnerSampling);
+                sim.seed(replicaSeed(static_cast<long long>(config.seedGroup) * replicas + task % replicas));
+                sim.initialize();
+                int iteration = sim.execute();
+
+                rounds.clear();
+                sim.addCommunicationRounds(rounds);
+
+                lock_guard<mutex> lock(summaryLocks[configIndex]);
+                BatchSummary& summary = summaries[configIndex];
+                summary.iterations.add(iteration);
+                summary.communicationRounds.merge(rounds);
+                summary.completedAgents += sim.completedAgents();
+                if (sim.status() == RunStatus::StepLimit) summary.stepLimitHits++;
+                else if (sim.status() == RunStatus::Deadlocked) summary.deadlocks++;
+                else if (sim.status() == RunStatus::Stalled) summary.stalls++;
+            }
+        });
+
+        return summaries;
+    }
+
+    unsigned long long replicaSeed(long long globalReplicaIndex) const {
+        return splitMix64(masterSeed ^ splitMix64(static_cast<unsigned long long>(globalReplicaIndex)));
+    }
+
+    static void writePartial(ostream& out, const vector<BatchSummary>& summaries) {
+        out << "lab2-partial;1\n";
+        for (size_t c = 0; c < summaries.size(); c++) {
+            const BatchSummary& summary = summaries[c];
+            out << "config;" << c << ";" << summary.config.agentCount << ";" << summary.config.patentsPerAgent << ";"
+                << partnerSamplingName(summary.config.partnerSampling) << ";" << summary.config.seedGroup << ";"
+                << summary.stepLimitHits << ";" << summary.deadlocks << ";" << summary.stalls << ";"
+                << summary.completedAgents << "\n";
+            writeHistogram(out, "iterations", summary.iterations);
+            writeHistogram(out, "rounds", summary.communicationRounds);
+        }
+    }
+
+    static bool readPartial(istream& in, vector<BatchSummary>& summaries) {
+        string line;
+        if (!getline(in, line) || line != "lab2-partial;1") return false;
+        BatchSummary* current = nullptr;
+        while (getline(in, line)) {
+            if (line.empty()) continue;
+            vector<string> fields;
+            stringstream row(line);
+            string field;
+            while (getline(row, field, ';')) fields.push_back(field);
+
+            if (fields[0] == "config") {
+                if (fields.size() != 10) return false;
+                size_t index = stoul(fields[1]);
+                BatchConfig config = { stoi(fields[2]), stoi(fields[3]), parsePartnerSampling(fields[4]), stoi(fields[5]) };
+                if (index >= summaries.size()) summaries.resize(index + 1);
+                current = &summaries[index];
+                if (current->iterations.total == 0 && current->config.agentCount == 0) current->config = config;
+                else if (current->config.agentCount != config.agentCount || current->config.patentsPerAgent != config.patentsPerAgent
+                    || current->config.partnerSampling != config.partnerSampling || current->config.seedGroup != config.seedGroup) return false;
+                current->stepLimitHits += stoi(fields[6]);
+                current->deadlocks += stoi(fields[7]);
+                current->stalls += stoi(fields[8]);
+                current->completedAgents += stoll(fields[9]);
+            }
+            else if (current && (fields[0] == "iterations" || fields[0] == "rounds")) {
+                IntHistogram& histogram = fields[0] == "iterations" ? current->iterations : current->communicationRounds;
+                for (size_t k = 1; k < fields.size(); k++) {
+                    size_t colon = fields[k].find(':');
+                    if (colon == string::npos) return false;
+                    histogram.add(stoi(fields[k].substr(0, colon)), stoll(fields[k].substr(colon + 1)));
+                }
+            }
+            else {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static void printSummaries(const vector<BatchSummary>& summaries) {
+        cout << "agents;patents;sampling;replicas;limitHits;deadlocks;stalls;iterMean;iterP50;iterP90;iterP99;"
+            << "roundsMean;roundsP50;roundsP90;roundsP99;roundsPerCompletion\n";
+        for (const auto& summary : summaries) {
+            const IntHistogram& it = summary.iterations;
+            const IntHistogram& rounds = summary.communicationRounds;
+            double roundsPerCompletion = summary.completedAgents
+                ? static_cast<double>(rounds.sum) / summary.completedAgents : 0.0;
+            cout << summary.config.agentCount << ";" << summary.config.patentsPerAgent << ";"
+                << partnerSamplingName(summary.config.partnerSampling) << ";"
+                << it.total << ";" << summary.stepLimitHits << ";" << summary.deadlocks << ";" << summary.stalls << ";"
+                << it.mean() << ";" << it.percentile(0.5) << ";" << it.percentile(0.9) << ";" << it.percentile(0.99) << ";"
+                << rounds.mean() << ";" << rounds.percentile(0.5) << ";" << rounds.percentile(0.9) << ";" << rounds.percentile(0.99) << ";"
+                << roundsPerCompletion << "\n";
+        }
     }
 
 private:
-    void createAgents() {
-        for (int i = 0; i < agentCount; i++) {
-            agentList.emplace_back(i);
+    vector<BatchConfig> grid;
+    int replicas;
+    unsigned long long masterSeed;
+    int threads;
+    AgentLayout layout = AgentLayout::ArrayOfStructs;
+    int stallWindow = 0;
+    int firstTask = 0;
+    int lastTask = -1;
+
+    static void writeHistogram(ostream& out, const char* name, const IntHistogram& histogram) {
+        out << name;
+        for (size_t value = 0; value < histogram.counts.size(); value++) {
+            if (histogram.counts[value]) out << ";" << value << ":" << histogram.counts[value];
         }
+        out << "\n";
     }
+};
 
-    void assignTargetPatents() {
-        int globalPatentId = 0;
-        for (auto& agent : agentList) {
-            for (int j = 0; j < patentsPerAgentTarget; j++) {
-                agent.targetPatents.insert(globalPatentId++);
+class AgentBenchmarks {
+public:
+    AgentBenchmarks(vector<pair<int, int>> configGrid, long long memoryLimitMb)
+        : configs(move(configGrid)), memoryLimitBytes(memoryLimitMb << 20) {}
+
+    bool run() {
+        bool allRan = true;
+        cout << "benchmark;layout;agents;patents;operations;nsPerOp;opsPerSec\n";
+        for (const auto& config : configs) {
+            for (const LayoutCase& layout : LAYOUTS) {
+                long long bytes = static_cast<long long>(config.first) * config.second * layout.bytesPerTarget;
+                if (bytes > memoryLimitBytes) {
+                    cout << "failed;" << layout.name << ";" << config.first << ";" << config.second << ";0;0;0\n";
+                    cerr << "Конфигурация " << config.first << "x" << config.second << " (" << layout.name
+                        << ") требует около " << (bytes >> 20) << " МБ, лимит " << (memoryLimitBytes >> 20) << " МБ\n";
+                    allRan = false;
+                    continue;
+                }
+                runConfig(config.first, config.second, layout.layout, layout.name);
             }
         }
+        return allRan;
     }
 
-    void distributeInitialPatents() {
-        vector<int> allPatents;
-        for (auto& agent : agentList) {
-            allPatents.insert(allPatents.end(), agent.targetPatents.begin(), agent.targetPatents.end());
+private:
+    struct LayoutCase {
+        AgentLayout layout;
+        const char* name;
+        long long bytesPerTarget;
+    };
+
+    static constexpr LayoutCase LAYOUTS[] = {
+        { AgentLayout::ArrayOfStructs, "aos", 96 },
+        { AgentLayout::StructOfArrays, "soa", 80 },
+        { AgentLayout::OrderedSets, "set", 256 } };
+    vector<pair<int, int>> configs;
+    long long memoryLimitBytes;
+    const unsigned long long BENCHMARK_SEED = 42;
+    const double MIN_SECONDS = 0.2;
+    const int PAIRS_PER_PASS = 1 << 16;
+    const int ITERATIONS_PER_PASS = 16;
+
+    static double secondsSince(chrono::steady_clock::time_point start) {
+        return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+
+    static void report(const char* name, const char* layout, int agents, int patents, long long operations, double seconds) {
+        cout << name << ";" << layout << ";" << agents << ";" << patents << ";" << operations << ";"
+            << seconds * 1e9 / max(1LL, operations) << ";" << operations / max(seconds, 1e-12) << "\n";
+    }
+
+    void runConfig(int agents, int patents, AgentLayout layout, const char* layoutName) {
+        Simulation<> sim(agents, patents, layout);
+        sim.seed(BENCHMARK_SEED);
+        sim.initialize();
+
+        mt19937 pairRng(static_cast<unsigned>(BENCHMARK_SEED));
+        uniform_int_distribution<int> dist(0, agents - 1);
+        vector<pair<int, int>> pairs(PAIRS_PER_PASS);
+        for (auto& p : pairs) {
+            p.first = dist(pairRng);
+            do p.second = dist(pairRng); while (agents > 1 && p.second == p.first);
         }
 
-        shuffle(allPatents.begin(), allPatents.end(), rng);
+        sim.withAgents([&](const auto& store) {
+            volatile int sink = 0;
+            timeQueries("findNeededPatent", layoutName, agents, patents, pairs, [&](int i, int j) { sink = sink + store.findNeededPatent(i, j); });
+            timeQueries("findGiveablePatent", layoutName, agents, patents, pairs, [&](int i, int j) { sink = sink + store.findGiveablePatent(i, j); });
+        });
+
+        long long exchanges = 0;
+        double exchangeSeconds = 0.0;
+        vector<pair<int, int>> sweep(agents);
+        while (exchangeSeconds < MIN_SECONDS) {
+            for (int k = 0; k < agents; k++) sweep[k].first = k;
+            shuffle(sweep.begin(), sweep.end(), pairRng);
+            for (auto& p : sweep) {
+                do p.second = dist(pairRng); while (agents > 1 && p.second == p.first);
+            }
+            sim.seed(BENCHMARK_SEED);
+            sim.initialize();
+            sim.withAgents([&](auto& store) {
+                auto start = chrono::steady_clock::now();
+                for (const auto& p : sweep) store.exchange(p.first, p.second);
+                exchangeSeconds += secondsSince(start);
+            });
+            exchanges += agents;
+        }
+        report("exchangeWith", layoutName, agents, patents, exchanges, exchangeSeconds);
 
-        for (int i = 0; i < allPatents.size(); i++) {
-            agentList[i % agentCount].currentPatents.insert(allPatents[i]);
+        long long iterations = 0;
+        long long iterationExchanges = 0;
+        double iterationSeconds = 0.0;
+        while (iterationSeconds < MIN_SECONDS) {
+            sim.seed(BENCHMARK_SEED);
+            sim.initialize();
+            auto start = chrono::steady_clock::now();
+            iterations += sim.executeSteps(ITERATIONS_PER_PASS);
+            iterationSeconds += secondsSince(start);
+            iterationExchanges += sim.totalExchangesAttempted();
         }
+        report("simulateIteration", layoutName, agents, patents, iterations, iterationSeconds);
+        report("simulateIterationExchange", layoutName, agents, patents, iterationExchanges, iterationSeconds);
+    }
 
-        for (auto& agent : agentList) {
-            agent.updateMissingPatents();
+    template <class Query>
+    void timeQueries(const char* name, const char* layoutName, int agents, int patents,
+        const vector<pair<int, int>>& pairs, Query query) {
+        long long operations = 0;
+        auto start = chrono::steady_clock::now();
+        double seconds = 0.0;
+        while (seconds < MIN_SECONDS) {
+            for (const auto& p : pairs) query(p.first, p.second);
+            operations += static_cast<long long>(pairs.size());
+            seconds = secondsSince(start);
         }
+        report(name, layoutName, agents, patents, operations, seconds);
     }
+};
+
+struct BenchmarkRow {
+    string lab;
+    string workload;
+    int threads = 0;
+    unsigned long long seed = 0;
+    double setupMs = 0.0;
+    double runMs = 0.0;
+    double outputMs = 0.0;
+    string unit;
+    long long count = 0;
+    double perSec = 0.0;
+    long long peakRssKb = 0;
+    unsigned long long checksum = 0;
+};
+
+inline long long peakResidentKb() {
+#ifdef LAB2_RUSAGE
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#else
+    return 0;
+#endif
+}
 
+class BenchmarkTable {
 public:
-    void run() {
-        bool allAgentsComplete = false;
-        int iteration = 0;
+    static void writeHeader(ostream& out) {
+        out << "lab;workload;threads;seed;setupMs;runMs;outputMs;unit;count;perSec;peakRssKb;checksum\n";
+    }
+
+    static void write(ostream& out, const BenchmarkRow& row) {
+        out << row.lab << ";" << row.workload << ";" << row.threads << ";" << row.seed << ";"
+            << row.setupMs << ";" << row.runMs << ";" << row.outputMs << ";" << row.unit << ";"
+            << row.count << ";" << row.perSec << ";" << row.peakRssKb << ";" << row.checksum << "\n";
+    }
+
+    static vector<BenchmarkRow> read(istream& in) {
+        vector<BenchmarkRow> rows;
+        string line;
+        while (getline(in, line)) {
+            vector<string> fields;
+            stringstream stream(line);
+            string field;
+            while (getline(stream, field, ';')) fields.push_back(field);
+            if (fields.size() != 12 || fields[0] == "lab") continue;
+            BenchmarkRow row;
+            row.lab = fields[0];
+            row.workload = fields[1];
+            row.threads = stoi(fields[2]);
+            row.seed = stoull(fields[3]);
+            row.setupMs = stod(fields[4]);
+            row.runMs = stod(fields[5]);
+            row.outputMs = stod(fields[6]);
+            row.unit = fields[7];
+            row.count = stoll(fields[8]);
+            row.perSec = stod(fields[9]);
+            row.peakRssKb = stoll(fields[10]);
+            row.checksum = stoull(fields[11]);
+            rows.push_back(row);
+        }
+        return rows;
+    }
 
-        while (!allAgentsComplete && iteration < MAX_SIMULATION_STEPS) {
-            iteration++;
-            allAgentsComplete = simulateIteration(iteration);
+    static bool compare(ostream& out, const vector<BenchmarkRow>& baseline, const vector<BenchmarkRow>& current, double tolerance) {
+        bool regressed = false;
+        out << "lab;workload;threads;baselinePerSec;perSec;ratio;baselineRssKb;peakRssKb;verdict\n";
+        for (const auto& row : current) {
+            auto match = find_if(baseline.begin(), baseline.end(), [&](const BenchmarkRow& old) {
+                return old.lab == row.lab && old.workload == row.workload && old.threads == row.threads;
+            });
+            out << row.lab << ";" << row.workload << ";" << row.threads << ";";
+            if (match == baseline.end()) {
+                out << "-;" << row.perSec << ";-;-;" << row.peakRssKb << ";new\n";
+                continue;
+            }
+            double ratio = row.perSec / max(match->perSec, 1e-12);
+            const char* verdict = "ok";
+            if (match->checksum != row.checksum) verdict = "changed";
+            else if (ratio < 1.0 - tolerance) verdict = "slower";
+            else if (ratio > 1.0 + tolerance) verdict = "faster";
+            if (match->checksum != row.checksum || ratio < 1.0 - tolerance) regressed = true;
+            out << match->perSec << ";" << row.perSec << ";" << ratio << ";"
+                << match->peakRssKb << ";" << row.peakRssKb << ";" << verdict << "\n";
         }
+        return !regressed;
+    }
+};
+
+class BenchmarkSuite {
+public:
+    BenchmarkSuite(int threadCount, AgentLayout agentLayout) : threads(threadCount), layout(agentLayout) {}
+
+    vector<BenchmarkRow> run(ostream& out) {
+        ScenarioSpec large;
+        large.agentCount = 1000000;
+        large.patentSpace = 256;
+        large.targetsPerAgent = 8;
+        large.targetSpread = 2.0;
+        large.holdingExponent = 1.0;
 
-        printResults(iteration);
+        vector<BenchmarkRow> rows;
+        BenchmarkTable::writeHeader(out);
+        for (const Workload& workload : {
+            Workload{ "agents-20", 20, 5, ScenarioSpec(), 10000, 10000 },
+            Workload{ "agents-10k", 10000, 5, ScenarioSpec(), 1, 500 },
+            Workload{ "agents-1M", large.agentCount, large.targetsPerAgent, large, 1, 20 } }) {
+            rows.push_back(runWorkload(workload));
+            BenchmarkTable::write(out, rows.back());
+            out.flush();
+        }
+        return rows;
     }
 
 private:
-    bool simulateIteration(int iteration) {
-        bool allComplete = true;
-        vector<int> activeAgents;
+    struct Workload {
+        const char* name;
+        int agents;
+        int patents;
+        ScenarioSpec scenario;
+        int replicas;
+        int maxSteps;
+    };
 
-        for (int i = 0; i < agentCount; i++) {
-            if (!agentList[i].isComplete()) activeAgents.push_back(i);
+    class NullBuffer : public streambuf {
+    protected:
+        int overflow(int c) override { return c; }
+        streamsize xsputn(const char*, streamsize count) override { return count; }
+    };
+
+    int threads;
+    AgentLayout layout;
+    const unsigned long long SUITE_SEED = 42;
+    const int PASSES = 3;
+
+    static double millisecondsBetween(chrono::steady_clock::time_point start, chrono::steady_clock::time_point end) {
+        return chrono::duration<double, milli>(end - start).count();
+    }
+
+    BenchmarkRow runWorkload(const Workload& workload) {
+        BenchmarkRow row;
+        row.lab = "lab2";
+        row.workload = workload.name;
+        if (layout == AgentLayout::StructOfArrays) row.workload += "-soa";
+        else if (layout == AgentLayout::OrderedSets) row.workload += "-sets";
+        row.threads = threads;
+        row.seed = SUITE_SEED;
+        row.unit = "exchanges";
+
+        Simulation<> sim(workload.agents, workload.patents, layout);
+        if (threads > 0) sim.useParallelRounds(threads);
+        NullBuffer sink;
+        ostream discard(&sink);
+        for (int pass = 0; pass < PASSES; pass++) {
+            BenchmarkRow timing;
+            unsigned long long checksum = SUITE_SEED;
+            for (int r = 0; r < workload.replicas; r++) {
+                auto start = chrono::steady_clock::now();
+                sim.seed(splitMix64(SUITE_SEED ^ splitMix64(static_cast<unsigned long long>(r))));
+                if (workload.scenario.agentCount > 0) sim.setScenario(workload.scenario);
+                sim.initialize();
+                auto setupEnd = chrono::steady_clock::now();
+                int iteration = sim.executeSteps(workload.maxSteps);
+                auto runEnd = chrono::steady_clock::now();
+                sim.writeResults(discard, iteration);
+                auto outputEnd = chrono::steady_clock::now();
+
+                timing.setupMs += millisecondsBetween(start, setupEnd);
+                timing.runMs += millisecondsBetween(setupEnd, runEnd);
+                timing.outputMs += millisecondsBetween(runEnd, outputEnd);
+                timing.count += sim.totalExchangesAttempted();
+                checksum = splitMix64(checksum ^ static_cast<unsigned long long>(iteration));
+                checksum = splitMix64(checksum ^ static_cast<unsigned long long>(sim.totalExchangesAttempted()));
+                checksum = splitMix64(checksum ^ static_cast<unsigned long long>(sim.completedAgents()));
+            }
+            if (pass == 0 || timing.runMs < row.runMs) {
+                row.setupMs = timing.setupMs;
+                row.runMs = timing.runMs;
+                row.outputMs = timing.outputMs;
+            }
+            row.count = timing.count;
+            row.checksum = checksum;
         }
+        row.perSec = row.count / max(row.runMs / 1000.0, 1e-12);
+        row.peakRssKb = peakResidentKb();
+        return row;
+    }
+};
 
-        shuffle(activeAgents.begin(), activeAgents.end(), rng);
+vector<int> parseIntList(const string& text) {
+    vector<int> values;
+    stringstream stream(text);
+    string item;
+    while (getline(stream, item, ',')) {
+        if (!item.empty()) values.push_back(stoi(item));
+    }
+    return values;
+}
 
-        for (int i : activeAgents) {
-            if (agentList[i].isComplete()) continue;
+bool parseShard(const string& text, long long& index, long long& count) {
+    size_t slash = text.find('/');
+    if (slash == string::npos || slash == 0 || slash + 1 == text.size()) return false;
+    string indexText = text.substr(0, slash), countText = text.substr(slash + 1);
+    if (indexText.find_first_not_of("0123456789") != string::npos || countText.find_first_not_of("0123456789") != string::npos) return false;
+    try {
+        index = stoll(indexText);
+        count = stoll(countText);
+    }
+    catch (const out_of_range&) {
+        return false;
+    }
+    return count >= 1 && count <= 1000000000 && index < count;
+}
 
-            allComplete = false;
+int main(int argc, char* argv[]) {
+    setlocale(LC_ALL, "Russian");
 
-            uniform_int_distribution<int> dist(0, agentCount - 1);
-            int j = dist(rng);
-            if (j == i) continue;
+    AgentLayout layout = AgentLayout::ArrayOfStructs;
+    PartnerSampling sampling = PartnerSampling::Uniform;
+    int threadCount = 0;
+    bool batchMode = false;
+    bool comparePartners = false;
+    bool benchMode = false;
+    long long benchMemoryMb = 1024;
+    bool benchSuite = false;
+    string benchBaselinePath;
+    double benchTolerance = 0.15;
+    bool gridGiven = false;
+    bool quiet = false;
+    bool fastRng = false;
+    long long shardIndex = 0, shardCount = 1;
+    string partialPath;
+    vector<string> mergeFiles;
+    int stallWindow = 0;
+    string telemetryPath;
+    ScenarioSpec scenario;
+    bool scenarioGiven = false;
+    string saveScenarioPath;
+    string loadScenarioPath;
+    string checkpointPath;
+    string restorePath;
+    int checkpointEvery = 1000;
+    vector<int> batchAgents = { 20 };
+    vector<int> batchPatents = { 5 };
+    int replicas = 100;
+    unsigned long long masterSeed = random_device{}();
+    bool seedGiven = false;
+    for (int a = 1; a < argc; a++) {
+        string arg = argv[a];
+        if (arg == "--soa") layout = AgentLayout::StructOfArrays;
+        else if (arg == "--sets") layout = AgentLayout::OrderedSets;
+        else if (arg == "--useful-partners") sampling = PartnerSampling::Useful;
+        else if (arg == "--informed-partners") sampling = PartnerSampling::Informed;
+        else if (arg == "--compare-partners") comparePartners = true;
+        else if (arg == "--threads" && a + 1 < argc) threadCount = stoi(argv[++a]);
+        else if (arg == "--batch") batchMode = true;
+        else if (arg == "--bench") benchMode = true;
+        else if (arg == "--bench-memory-mb" && a + 1 < argc) benchMemoryMb = stoll(argv[++a]);
+        else if (arg == "--bench-suite") benchSuite = true;
+        else if (arg == "--bench-baseline" && a + 1 < argc) benchBaselinePath = argv[++a];
+        else if (arg == "--bench-tolerance" && a + 1 < argc) benchTolerance = stod(argv[++a]);
+        else if (arg == "--quiet") quiet = true;
+        else if (arg == "--fast-rng") fastRng = true;
+        else if (arg == "--partial" && a + 1 < argc) partialPath = argv[++a];
+        else if (arg == "--merge") {
+            while (a + 1 < argc && string(argv[a + 1]).compare(0, 2, "--") != 0) mergeFiles.push_back(argv[++a]);
+            if (mergeFiles.empty()) {
+                cerr << "Не указаны файлы для объединения после --merge\n";
+                return 1;
+            }
+        }
+        else if (arg == "--shard" && a + 1 < argc) {
+            if (!parseShard(argv[++a], shardIndex, shardCount)) {
+                cerr << "Неверный номер части: " << argv[a] << " (ожидается k/N, где N >= 1 и 0 <= k < N)\n";
+                return 1;
+            }
+        }
+        else if (arg == "--stall-window" && a + 1 < argc) stallWindow = stoi(argv[++a]);
+        else if (arg == "--telemetry" && a + 1 < argc) telemetryPath = argv[++a];
+        else if (arg == "--scenario-patents" && a + 1 < argc) { scenario.patentSpace = stoi(argv[++a]); scenarioGiven = true; }
+        else if (arg == "--target-spread" && a + 1 < argc) { scenario.targetSpread = stod(argv[++a]); scenarioGiven = true; }
+        else if (arg == "--holding-exponent" && a + 1 < argc) { scenario.holdingExponent = stod(argv[++a]); scenarioGiven = true; }
+        else if (arg == "--save-scenario" && a + 1 < argc) saveScenarioPath = argv[++a];
+        else if (arg == "--load-scenario" && a + 1 < argc) loadScenarioPath = argv[++a];
+        else if (arg == "--checkpoint" && a + 1 < argc) checkpointPath = argv[++a];
+        else if (arg == "--checkpoint-every" && a + 1 < argc) checkpointEvery = stoi(argv[++a]);
+        else if (arg == "--restore" && a + 1 < argc) restorePath = argv[++a];
+        else if (arg == "--agents" && a + 1 < argc) { batchAgents = parseIntList(argv[++a]); gridGiven = true; }
+        else if (arg == "--patents" && a + 1 < argc) { batchPatents = parseIntList(argv[++a]); gridGiven = true; }
+        else if (arg == "--replicas" && a + 1 < argc) replicas = stoi(argv[++a]);
+        else if (arg == "--seed" && a + 1 < argc) {
+            masterSeed = stoull(argv[++a]);
+            seedGiven = true;
+        }
+    }
 
-            if (agentList[i].exchangeWith(agentList[j]) && agentList[i].completionStep == 0) {
-                agentList[i].completionStep = iteration;
+    if (benchSuite) {
+        vector<BenchmarkRow> baseline;
+        if (!benchBaselinePath.empty()) {
+            ifstream in(benchBaselinePath);
+            if (!in) {
+                cerr << "Не удалось открыть базовые результаты: " << benchBaselinePath << "\n";
+                return 1;
             }
+            baseline = BenchmarkTable::read(in);
         }
+        BenchmarkSuite suite(threadCount, layout);
+        vector<BenchmarkRow> rows = suite.run(cout);
+        if (benchBaselinePath.empty()) return 0;
+        return BenchmarkTable::compare(cerr, baseline, rows, benchTolerance) ? 0 : 2;
+    }
 
-        return allComplete;
+    if (benchMode) {
+        vector<pair<int, int>> configs = { { 20, 5 }, { 20, 50 }, { 20, 500 }, { 1000, 5 }, { 1000, 50 }, { 1000, 500 },
+            { 10000, 5 }, { 10000, 50 }, { 10000, 500 }, { 100000, 5 }, { 100000, 50 }, { 1000000, 5 } };
+        if (gridGiven) {
+            configs.clear();
+            for (int agents : batchAgents) {
+                for (int patents : batchPatents) configs.emplace_back(agents, patents);
+            }
+        }
+        AgentBenchmarks benchmarks(configs, benchMemoryMb);
+        return benchmarks.run() ? 0 : 1;
     }
 
-    void printResults(int iteration) const {
-        cout << "=== Результаты моделирования ===\n";
-        for (const auto& agent : agentList) {
-            cout << "Агент " << agent.id
-                << " | Целевой набор: " << agent.targetPatents.size()
-                << " | Итерации: " << agent.completionStep
-                << " | Раунды коммуникаций: " << agent.communicationRounds << endl;
+    if (!mergeFiles.empty()) {
+        vector<BatchSummary> summaries;
+        for (const auto& path : mergeFiles) {
+            ifstream in(path);
+            if (!BatchRunner::readPartial(in, summaries)) {
+                cerr << "Не удалось прочитать частичные результаты: " << path << "\n";
+                return 1;
+            }
         }
+        BatchRunner::printSummaries(summaries);
+        return 0;
+    }
 
-        if (iteration >= MAX_SIMULATION_STEPS)
-            cout << "\nВнимание: Достигнут лимит итераций.\n";
-        else
-            cout << "\nСимуляция завершена за " << iteration << " итераций.\n";
+    if (batchMode) {
+        vector<BatchConfig> grid;
+        int seedGroup = 0;
+        for (int agents : batchAgents) {
+            for (int patents : batchPatents) {
+                if (comparePartners && sampling != PartnerSampling::Uniform)
+                    grid.push_back({ agents, patents, PartnerSampling::Uniform, seedGroup });
+                grid.push_back({ agents, patents, sampling, seedGroup });
+                if (comparePartners && sampling == PartnerSampling::Uniform)
+                    grid.push_back({ agents, patents, PartnerSampling::Informed, seedGroup });
+                seedGroup++;
+            }
+        }
+        int batchThreads = threadCount > 0 ? threadCount : static_cast<int>(max(1u, thread::hardware_concurrency()));
+        BatchRunner runner(grid, replicas, masterSeed, batchThreads);
+        runner.setAgentLayout(layout);
+        runner.setStallWindow(stallWindow);
+        runner.setShard(shardIndex, shardCount);
+        vector<BatchSummary> summaries = fastRng ? runner.run<Xoshiro256StarStar>() : runner.run();
+        if (partialPath.empty()) {
+            BatchRunner::printSummaries(summaries);
+            return 0;
+        }
+        ofstream partial(partialPath);
+        BatchRunner::writePartial(partial, summaries);
+        if (!partial) {
+            cerr << "Не удалось записать частичные результаты: " << partialPath << "\n";
+            return 1;
+        }
+        return 0;
     }
-};
 
-int main() {
-    setlocale(LC_ALL, "Russian");
+    auto runSingle = [&](auto& sim) {
+        if (seedGiven) sim.seed(masterSeed);
+        sim.setPartnerSampling(sampling);
+        if (threadCount > 0) sim.useParallelRounds(threadCount);
+        sim.setResultsOutput(!quiet);
+        sim.setStallWindow(stallWindow);
+
+        unique_ptr<TelemetryWriter> telemetry;
+        if (!telemetryPath.empty()) {
+            telemetry = make_unique<TelemetryWriter>(telemetryPath);
+            if (!telemetry->isOpen()) {
+                cerr << "Не удалось открыть файл телеметрии: " << telemetryPath << "\n";
+                return 1;
+            }
+            sim.setTelemetry(telemetry.get());
+        }
 
-    Simulation sim(20, 5);
-    sim.initialize();
-    sim.run();
+        unique_ptr<CheckpointWriter> checkpoints;
+        if (!checkpointPath.empty()) {
+            checkpoints = make_unique<CheckpointWriter>(checkpointPath);
+            sim.setCheckpoints(checkpoints.get(), checkpointEvery);
+        }
 
-    return 0;
+        if (!restorePath.empty()) {
+            if (!sim.restoreCheckpoint(restorePath)) {
+                cerr << "Не удалось восстановить контрольную точку: " << restorePath << "\n";
+                return 1;
+            }
+        }
+        else if (!loadScenarioPath.empty()) {
+            if (!sim.loadScenario(loadScenarioPath)) {
+                cerr << "Не удалось загрузить сценарий: " << loadScenarioPath << "\n";
+                return 1;
+            }
+        }
+        else {
+            if (scenarioGiven) {
+                scenario.agentCount = batchAgents[0];
+                scenario.targetsPerAgent = batchPatents[0];
+                if (scenario.patentSpace <= 0) scenario.patentSpace = scenario.agentCount * scenario.targetsPerAgent;
+                sim.setScenario(scenario);
+            }
+            sim.initialize();
+        }
+
+        if (!saveScenarioPath.empty()) {
+            if (!sim.saveScenario(saveScenarioPath)) {
+                cerr << "Не удалось сохранить сценарий: " << saveScenarioPath << "\n";
+                return 1;
+            }
+            cout << "Сценарий сохранён: " << saveScenarioPath << "\n";
+            return 0;
+        }
+
+        sim.run();
+        if (checkpoints && checkpoints->failed()) {
+            cerr << "Не удалось записать контрольную точку: " << checkpointPath << "\n";
+            return 1;
+        }
+        return 0;
+    };
+
+    if (fastRng) {
+        Simulation<Xoshiro256StarStar> sim(20, 5, layout);
+        if (gridGiven) sim.reset(batchAgents[0], batchPatents[0]);
+        return runSingle(sim);
+    }
+    Simulation<> sim(20, 5, layout);
+    if (gridGiven) sim.reset(batchAgents[0], batchPatents[0]);
+    return runSingle(sim);
 }
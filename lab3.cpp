@@ -5,6 +5,192 @@
 #include <fstream>
 #include <string>
 #include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define LAB3_SSE2 1
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#define LAB3_RUSAGE 1
+#endif
+#ifdef LAB3_INSTRUMENT
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#endif
+
+inline std::uint64_t splitMix64(std::uint64_t value) {
+    value += 0x9E3779B97F4A7C15ULL;
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+    return value ^ (value >> 31);
+}
+
+class Xoshiro256StarStar {
+public:
+    using result_type = std::uint64_t;
+
+    explicit Xoshiro256StarStar(std::uint64_t seedValue = 0) {
+        seed(seedValue);
+    }
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return ~result_type(0); }
+
+    void seed(std::uint64_t seedValue) {
+        for (auto& word : state) {
+            seedValue += 0x9E3779B97F4A7C15ULL;
+            word = splitMix64(seedValue);
+        }
+    }
+
+    static Xoshiro256StarStar forStream(std::uint64_t masterSeed, std::uint64_t stream) {
+        return Xoshiro256StarStar(masterSeed ^ splitMix64(stream));
+    }
+
+    result_type operator()() {
+        result_type result = rotl(state[1] * 5, 7) * 9;
+        result_type t = state[1] << 17;
+        state[2] ^= state[0];
+        state[3] ^= state[1];
+        state[1] ^= state[2];
+        state[0] ^= state[3];
+        state[2] ^= t;
+        state[3] = rotl(state[3], 45);
+        return result;
+    }
+
+private:
+    std::uint64_t state[4];
+
+    static result_type rotl(result_type x, int k) {
+        return (x << k) | (x >> (64 - k));
+    }
+};
+
+template <class Engine>
+class RandomSource {
+public:
+    Engine engine;
+
+    void seed(std::uint64_t seedValue) {
+        engine.seed(static_cast<typename Engine::result_type>(seedValue ^ (seedValue >> 32)));
+    }
+
+    double uniform(double a, double b) {
+        return a + (b - a) * unit(engine);
+    }
+
+    int below(int count) {
+        return std::uniform_int_distribution<int>(0, count - 1)(engine);
+    }
+
+private:
+    std::uniform_real_distribution<double> unit{ 0.0, 1.0 };
+};
+
+template <>
+class RandomSource<Xoshiro256StarStar> {
+public:
+    Xoshiro256StarStar engine;
+
+    void seed(std::uint64_t seedValue) {
+        engine.seed(seedValue);
+        next = BATCH_SIZE;
+    }
+
+    double uniform(double a, double b) {
+        if (next == BATCH_SIZE) refill();
+        return a + (b - a) * batch[next++];
+    }
+
+    int below(int count) {
+        return static_cast<int>(((engine() >> 32) * static_cast<std::uint64_t>(count)) >> 32);
+    }
+
+private:
+    static const int BATCH_SIZE = 64;
+    double batch[BATCH_SIZE];
+    int next = BATCH_SIZE;
+
+    void refill() {
+        for (int k = 0; k < BATCH_SIZE; k++) {
+            batch[k] = static_cast<double>(engine() >> 11) * 0x1.0p-53;
+        }
+        next = 0;
+    }
+};
+
+struct MatchCounters {
+    long long points = 0;
+    long long shots = 0;
+    long long agentOutBalls = 0;
+    long long botOutBalls = 0;
+    long long errorPerturbations = 0;
+    long long errorOffCourt = 0;
+    long long botMisses = 0;
+    long long agentMisses = 0;
+    std::uint64_t chooseCycles = 0;
+    std::uint64_t moveCycles = 0;
+    std::uint64_t rallyCycles = 0;
+
+    void merge(const MatchCounters& other) {
+        points += other.points;
+        shots += other.shots;
+        agentOutBalls += other.agentOutBalls;
+        botOutBalls += other.botOutBalls;
+        errorPerturbations += other.errorPerturbations;
+        errorOffCourt += other.errorOffCourt;
+        botMisses += other.botMisses;
+        agentMisses += other.agentMisses;
+        chooseCycles += other.chooseCycles;
+        moveCycles += other.moveCycles;
+        rallyCycles += other.rallyCycles;
+    }
+};
+
+#ifdef LAB3_INSTRUMENT
+inline thread_local MatchCounters threadCounters;
+
+inline std::uint64_t cycleCounter() {
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return static_cast<std::uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+#define LAB3_COUNT(field) (threadCounters.field++)
+#define LAB3_COUNT_ADD(field, amount) (threadCounters.field += (amount))
+#else
+#define LAB3_COUNT(field) ((void)0)
+#define LAB3_COUNT_ADD(field, amount) ((void)0)
+#endif
+
+#if defined(LAB3_INSTRUMENT) && defined(LAB3_INSTRUMENT_TIMERS)
+#define LAB3_TIME_BEGIN(name) std::uint64_t name##Begin = cycleCounter()
+#define LAB3_TIME_END(name, field) (threadCounters.field += cycleCounter() - name##Begin)
+#else
+#define LAB3_TIME_BEGIN(name) ((void)0)
+#define LAB3_TIME_END(name, field) ((void)0)
+#endif
 
 struct Position {
     double x, y;
@@ -21,17 +207,33 @@ public:
     double width, height;
     int n;
     std::vector<Square> squares;
+    std::vector<double> centerX;
+    std::vector<double> centerY;
 
     Court(double width, double height, int n) : width(width), height(height), n(n) {
         generateSquares();
     }
 
+    static std::shared_ptr<const Court> cached(double width, double height, int n) {
+        static std::mutex cacheLock;
+        static std::map<std::tuple<double, double, int>, std::shared_ptr<const Court>> cache;
+        std::lock_guard<std::mutex> lock(cacheLock);
+        auto& court = cache[std::make_tuple(width, height, n)];
+        if (!court) court = std::make_shared<const Court>(width, height, n);
+        return court;
+    }
+
     void generateSquares() {
         double squareSizeX = width / n;
         double squareSizeY = height / n;
+        squares.reserve(static_cast<size_t>(n) * n);
+        centerX.reserve(static_cast<size_t>(n) * n);
+        centerY.reserve(static_cast<size_t>(n) * n);
         for (int i = 0; i < n; i++) {
             for (int j = 0; j < n; j++) {
                 squares.push_back({ {(i + 0.5) * squareSizeX, (j + 0.5) * squareSizeY}, squareSizeX, i, j });
+                centerX.push_back(squares.back().center.x);
+                centerY.push_back(squares.back().center.y);
             }
         }
     }
@@ -43,9 +245,239 @@ public:
     bool isOut(const Position& p) const {
         return p.x < 0.0 || p.x > width || p.y < 0.0 || p.y > height;
     }
+
+    int nearestSquareIndex(const Position& p) const {
+        int rows[3], cols[3];
+        int rowCount = nearestAxisCandidates(p.x, width / n, rows);
+        int colCount = nearestAxisCandidates(p.y, height / n, cols);
+        return pickCandidate(p, rows, rowCount, cols, colCount, false);
+    }
+
+    int farthestSquareIndex(const Position& p) const {
+        int corners[2] = { 0, n - 1 };
+        int cornerCount = n > 1 ? 2 : 1;
+        return pickCandidate(p, corners, cornerCount, corners, cornerCount, true);
+    }
+
+private:
+    int nearestAxisCandidates(double p, double squareSize, int* cells) const {
+        int guess = std::min(n - 1, std::max(0, static_cast<int>(std::floor(p / squareSize))));
+        int count = 0;
+        for (int i = std::max(0, guess - 1); i <= std::min(n - 1, guess + 1); i++) cells[count++] = i;
+        return count;
+    }
+
+    int pickCandidate(const Position& p, const int* rows, int rowCount, const int* cols, int colCount, bool farthest) const {
+        int best = -1;
+        double bestDist = 0.0;
+        for (int a = 0; a < rowCount; a++) {
+            for (int b = 0; b < colCount; b++) {
+                int index = rows[a] * n + cols[b];
+                double dx = centerX[index] - p.x, dy = centerY[index] - p.y;
+                double dist2 = dx * dx + dy * dy;
+                if (best == -1 || (farthest ? dist2 > bestDist : dist2 < bestDist)) {
+                    best = index;
+                    bestDist = dist2;
+                }
+            }
+        }
+        return best;
+    }
 };
 
 
+#ifdef LAB3_SSE2
+inline void updateArgmax(__m128d value, __m128d index, __m128d& best, __m128d& bestIndex) {
+    __m128d better = _mm_cmpgt_pd(value, best);
+    best = _mm_or_pd(_mm_and_pd(better, value), _mm_andnot_pd(better, best));
+    bestIndex = _mm_or_pd(_mm_and_pd(better, index), _mm_andnot_pd(better, bestIndex));
+}
+
+inline int reduceArgmax(__m128d best, __m128d bestIndex, int count, const double* tailValues, int tailStart) {
+    double values[2], indices[2];
+    _mm_storeu_pd(values, best);
+    _mm_storeu_pd(indices, bestIndex);
+    double bestValue = values[0];
+    int bestAt = static_cast<int>(indices[0]);
+    if (values[1] > bestValue || (values[1] == bestValue && indices[1] < bestAt)) {
+        bestValue = values[1];
+        bestAt = static_cast<int>(indices[1]);
+    }
+    for (int k = tailStart; k < count; k++) {
+        if (tailValues[k - tailStart] > bestValue) {
+            bestValue = tailValues[k - tailStart];
+            bestAt = k;
+        }
+    }
+    return bestAt;
+}
+#endif
+
+inline double greedySquareScore(double cx, double cy, const Position& agentPos, double agentR, const Position& botPos) {
+    double bx = cx - botPos.x, by = cy - botPos.y;
+    double ax = cx - agentPos.x, ay = cy - agentPos.y;
+    double botDist = std::sqrt(bx * bx + by * by);
+    double agentDist = std::sqrt(ax * ax + ay * ay);
+    double hitProbability = std::min(1.0, agentR / (agentDist + 0.1));
+    return botDist * hitProbability;
+}
+
+inline void greedySquareScores(const double* cx, const double* cy, int count,
+    const Position& agentPos, double agentR, const Position& botPos, double* scores) {
+    int k = 0;
+#ifdef LAB3_SSE2
+    __m128d ax = _mm_set1_pd(agentPos.x), ay = _mm_set1_pd(agentPos.y);
+    __m128d bx = _mm_set1_pd(botPos.x), by = _mm_set1_pd(botPos.y);
+    __m128d r = _mm_set1_pd(agentR), one = _mm_set1_pd(1.0), offset = _mm_set1_pd(0.1);
+    for (; k + 2 <= count; k += 2) {
+        __m128d x = _mm_loadu_pd(cx + k), y = _mm_loadu_pd(cy + k);
+        __m128d dbx = _mm_sub_pd(x, bx), dby = _mm_sub_pd(y, by);
+        __m128d dax = _mm_sub_pd(x, ax), day = _mm_sub_pd(y, ay);
+        __m128d botDist = _mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(dbx, dbx), _mm_mul_pd(dby, dby)));
+        __m128d agentDist = _mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(dax, dax), _mm_mul_pd(day, day)));
+        __m128d hitProbability = _mm_min_pd(_mm_div_pd(r, _mm_add_pd(agentDist, offset)), one);
+        _mm_storeu_pd(scores + k, _mm_mul_pd(botDist, hitProbability));
+    }
+#endif
+    for (; k < count; k++) scores[k] = greedySquareScore(cx[k], cy[k], agentPos, agentR, botPos);
+}
+
+template <int COUNT>
+inline int bestGreedySquareOf(const double* cx, const double* cy, int runtimeCount,
+    const Position& agentPos, double agentR, const Position& botPos) {
+    const int count = COUNT > 0 ? COUNT : runtimeCount;
+#ifdef LAB3_SSE2
+    __m128d ax = _mm_set1_pd(agentPos.x), ay = _mm_set1_pd(agentPos.y);
+    __m128d bx = _mm_set1_pd(botPos.x), by = _mm_set1_pd(botPos.y);
+    __m128d r = _mm_set1_pd(agentR), one = _mm_set1_pd(1.0), offset = _mm_set1_pd(0.1);
+    __m128d best = _mm_set1_pd(-1.0), bestIndex = _mm_setzero_pd();
+    __m128d index = _mm_set_pd(1.0, 0.0), step = _mm_set1_pd(2.0);
+    int k = 0;
+    for (; k + 2 <= count; k += 2) {
+        __m128d x = _mm_loadu_pd(cx + k), y = _mm_loadu_pd(cy + k);
+        __m128d dbx = _mm_sub_pd(x, bx), dby = _mm_sub_pd(y, by);
+        __m128d dax = _mm_sub_pd(x, ax), day = _mm_sub_pd(y, ay);
+        __m128d botDist = _mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(dbx, dbx), _mm_mul_pd(dby, dby)));
+        __m128d agentDist = _mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(dax, dax), _mm_mul_pd(day, day)));
+        __m128d hitProbability = _mm_min_pd(_mm_div_pd(r, _mm_add_pd(agentDist, offset)), one);
+        updateArgmax(_mm_mul_pd(botDist, hitProbability), index, best, bestIndex);
+        index = _mm_add_pd(index, step);
+    }
+    double tail[1];
+    for (int t = k; t < count; t++) tail[t - k] = greedySquareScore(cx[t], cy[t], agentPos, agentR, botPos);
+    return reduceArgmax(best, bestIndex, count, tail, k);
+#else
+    double bestScore = -1.0;
+    int bestAt = 0;
+    for (int k = 0; k < count; k++) {
+        double score = greedySquareScore(cx[k], cy[k], agentPos, agentR, botPos);
+        if (score > bestScore) {
+            bestScore = score;
+            bestAt = k;
+        }
+    }
+    return bestAt;
+#endif
+}
+
+inline int bestGreedySquare(const Court& court, const Position& agentPos, double agentR, const Position& botPos) {
+    const double* cx = court.centerX.data();
+    const double* cy = court.centerY.data();
+    switch (court.n) {
+    case 5: return bestGreedySquareOf<25>(cx, cy, 25, agentPos, agentR, botPos);
+    case 10: return bestGreedySquareOf<100>(cx, cy, 100, agentPos, agentR, botPos);
+    case 15: return bestGreedySquareOf<225>(cx, cy, 225, agentPos, agentR, botPos);
+    default: return bestGreedySquareOf<0>(cx, cy, static_cast<int>(court.centerX.size()), agentPos, agentR, botPos);
+    }
+}
+
+inline int extremeDistanceSquare(const Court& court, const Position& p, bool farthest) {
+    const double* cx = court.centerX.data();
+    const double* cy = court.centerY.data();
+    int count = static_cast<int>(court.centerX.size());
+    double sign = farthest ? 1.0 : -1.0;
+#ifdef LAB3_SSE2
+    __m128d px = _mm_set1_pd(p.x), py = _mm_set1_pd(p.y), signs = _mm_set1_pd(sign);
+    __m128d best = _mm_set1_pd(-1e300), bestIndex = _mm_setzero_pd();
+    __m128d index = _mm_set_pd(1.0, 0.0), step = _mm_set1_pd(2.0);
+    int k = 0;
+    for (; k + 2 <= count; k += 2) {
+        __m128d dx = _mm_sub_pd(_mm_loadu_pd(cx + k), px), dy = _mm_sub_pd(_mm_loadu_pd(cy + k), py);
+        __m128d dist2 = _mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy));
+        updateArgmax(_mm_mul_pd(dist2, signs), index, best, bestIndex);
+        index = _mm_add_pd(index, step);
+    }
+    double tail[1];
+    for (int t = k; t < count; t++) {
+        double dx = cx[t] - p.x, dy = cy[t] - p.y;
+        tail[t - k] = sign * (dx * dx + dy * dy);
+    }
+    return reduceArgmax(best, bestIndex, count, tail, k);
+#else
+    double bestValue = -1e300;
+    int bestAt = 0;
+    for (int k = 0; k < count; k++) {
+        double dx = cx[k] - p.x, dy = cy[k] - p.y;
+        double value = sign * (dx * dx + dy * dy);
+        if (value > bestValue) {
+            bestValue = value;
+            bestAt = k;
+        }
+    }
+    return bestAt;
+#endif
+}
+
+inline void moveAndReach(double* px, double* py, const double* reach, const double* step,
+    const double* tx, const double* ty, const char* live, char* reached, int count) {
+    int k = 0;
+#ifdef LAB3_SSE2
+    __m128d zero = _mm_setzero_pd();
+    for (; k + 2 <= count; k += 2) {
+        __m128d mask = _mm_castsi128_pd(_mm_set_epi64x(-static_cast<long long>(live[k + 1] != 0),
+            -static_cast<long long>(live[k] != 0)));
+        __m128d x = _mm_loadu_pd(px + k), y = _mm_loadu_pd(py + k);
+        __m128d targetX = _mm_loadu_pd(tx + k), targetY = _mm_loadu_pd(ty + k);
+        __m128d s = _mm_loadu_pd(step + k);
+        __m128d dx = _mm_sub_pd(targetX, x), dy = _mm_sub_pd(targetY, y);
+        __m128d dist = _mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy)));
+        __m128d arrive = _mm_cmple_pd(dist, s);
+        __m128d stepX = _mm_add_pd(x, _mm_mul_pd(_mm_div_pd(dx, dist), s));
+        __m128d stepY = _mm_add_pd(y, _mm_mul_pd(_mm_div_pd(dy, dist), s));
+        __m128d newX = _mm_or_pd(_mm_and_pd(arrive, targetX), _mm_andnot_pd(arrive, stepX));
+        __m128d newY = _mm_or_pd(_mm_and_pd(arrive, targetY), _mm_andnot_pd(arrive, stepY));
+        newX = _mm_or_pd(_mm_and_pd(mask, newX), _mm_andnot_pd(mask, x));
+        newY = _mm_or_pd(_mm_and_pd(mask, newY), _mm_andnot_pd(mask, y));
+        _mm_storeu_pd(px + k, newX);
+        _mm_storeu_pd(py + k, newY);
+        __m128d hx = _mm_sub_pd(targetX, newX), hy = _mm_sub_pd(targetY, newY);
+        __m128d hitDist = _mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(hx, hx), _mm_mul_pd(hy, hy)));
+        __m128d hit = _mm_andnot_pd(_mm_cmplt_pd(hy, zero), _mm_cmple_pd(hitDist, _mm_loadu_pd(reach + k)));
+        int bits = _mm_movemask_pd(_mm_and_pd(mask, hit));
+        reached[k] = static_cast<char>(bits & 1);
+        reached[k + 1] = static_cast<char>((bits >> 1) & 1);
+    }
+#endif
+    for (; k < count; k++) {
+        if (!live[k]) {
+            reached[k] = 0;
+            continue;
+        }
+        double dx = tx[k] - px[k], dy = ty[k] - py[k];
+        double dist = std::sqrt(dx * dx + dy * dy);
+        if (dist <= step[k]) {
+            px[k] = tx[k];
+            py[k] = ty[k];
+        }
+        else {
+            px[k] += dx / dist * step[k];
+            py[k] += dy / dist * step[k];
+        }
+        double hx = tx[k] - px[k], hy = ty[k] - py[k];
+        reached[k] = hy >= 0.0 && std::sqrt(hx * hx + hy * hy) <= reach[k];
+    }
+}
+
 class Player {
 public:
     Position pos;
@@ -58,13 +490,13 @@ public:
         double dx = ball.x - pos.x;
         double dy = ball.y - pos.y;
         if (dy < 0.0) return false; 
-        return std::hypot(dx, dy) <= r;
+        return std::sqrt(dx * dx + dy * dy) <= r;
     }
 
     void moveTo(Position target) {
         double dx = target.x - pos.x;
         double dy = target.y - pos.y;
-        double dist = std::hypot(dx, dy);
+        double dist = std::sqrt(dx * dx + dy * dy);
         if (dist <= l) {
             pos = target;
         }
@@ -75,238 +507,2211 @@ public:
     }
 };
 
-class Strategy {
-public:
-    double errorProb = 0.05;
-    int n;
+struct SquareCacheStats {
+    long long lookups = 0;
+    long long hits = 0;
+    long long rescores = 0;
+    long long fallbacks = 0;
 
-    bool trapMode = false;      
-    Position lastServeTarget;    
-    bool hasLastTarget = false;  
+    void merge(const SquareCacheStats& other) {
+        lookups += other.lookups;
+        hits += other.hits;
+        rescores += other.rescores;
+        fallbacks += other.fallbacks;
+    }
 
-    Strategy(int n) : n(n) {}
+    double hitRate() const {
+        return lookups ? static_cast<double>(hits) / lookups : 0.0;
+    }
+};
 
-    Square chooseSquare(const Player& agent, const Player& bot, const Court& court,
-        std::default_random_engine& rng, bool isServe = false) {
-        if (trapMode && hasLastTarget) {
-            double maxDist = -1.0;
-            Square farthestSquare = court.squares[0];
-            for (const auto& sq : court.squares) {
-                double dist = std::hypot(sq.center.x - lastServeTarget.x, sq.center.y - lastServeTarget.y);
-                if (dist > maxDist) {
-                    maxDist = dist;
-                    farthestSquare = sq;
-                }
-            }
-            trapMode = false; 
-            hasLastTarget = false;
-            return farthestSquare;
-        }
-
-        double bestScore = -1.0;
-        Square bestSquare = court.squares[0];
-
-        for (const auto& sq : court.squares) {
-            double botDist = std::hypot(sq.center.x - bot.pos.x, sq.center.y - bot.pos.y);
-            double agentDist = std::hypot(sq.center.x - agent.pos.x, sq.center.y - agent.pos.y);
-            double hitProbability = std::min(1.0, agent.r / (agentDist + 0.1));
-            double score = botDist * hitProbability;
-            if (score > bestScore) {
-                bestScore = score;
-                bestSquare = sq;
-            }
-        }
-
-        if (!isServe) {
-            std::uniform_real_distribution<double> errorDist(0.0, 1.0);
-            if (errorDist(rng) < errorProb) {
-                int dRow[] = { -1, 0, 1, 0 };
-                int dCol[] = { 0, -1, 0, 1 };
-                std::uniform_int_distribution<int> dir(0, 3);
-                int dirIndex = dir(rng);
-                int newRow = bestSquare.row + dRow[dirIndex];
-                int newCol = bestSquare.col + dCol[dirIndex];
-                if (newRow >= 0 && newRow < n && newCol >= 0 && newCol < n) {
-                    bestSquare = court.getSquare(newRow, newCol);
-                }
-                else {
-                    return Square{ {-1.0, -1.0}, 0.0, -1, -1 };
-                }
-            }
-        }
+class BestSquareCache {
+public:
+    bool exact = true;
+    double step = 0.05;
+    SquareCacheStats stats;
 
-        if (isServe) {
-            double minBotDist = 1e9;
-            Square nearSquare = bestSquare;
-            for (const auto& sq : court.squares) {
-                double botDist = std::hypot(sq.center.x - bot.pos.x, sq.center.y - bot.pos.y);
-                if (botDist < minBotDist) {
-                    minBotDist = botDist;
-                    nearSquare = sq;
-                }
-            }
+    BestSquareCache() : entries(CAPACITY) {}
 
-            lastServeTarget = nearSquare.center;
-            hasLastTarget = true;
-            trapMode = true; 
-            return nearSquare;
-        }
+    void bind(const Court& court, double agentR) {
+        if (boundCourt == &court && boundR == agentR) return;
+        boundCourt = &court;
+        boundR = agentR;
+        double diagonal = std::sqrt(court.width * court.width + court.height * court.height);
+        double saturation = std::max(agentR, 0.1);
+        double lipschitz = 1.0 + diagonal * agentR / (saturation * saturation);
+        errorBound = lipschitz * step * std::sqrt(2.0) + 1e-9;
+        clear();
+    }
 
-        return bestSquare;
+    void clear() {
+        generation++;
+        used = 0;
     }
-};
 
-class Match {
-public:
-    Player agent;
-    Player bot;
-    Court court;
-    Strategy strategy;
-    std::default_random_engine rng;
+    int bestSquare(const Court& court, const Position& agentPos, double agentR, const Position& botPos) {
+        bind(court, agentR);
+        stats.lookups++;
+        if (used * 2 >= CAPACITY) clear();
+        std::uint64_t key;
+        if (!quantize(agentPos, botPos, key)) return bestGreedySquare(court, agentPos, agentR, botPos);
 
-    int agentPoints = 0, botPoints = 0;
-    int agentGames = 0, botGames = 0;
-    int agentSets = 0, botSets = 0;
+        size_t slot = static_cast<size_t>(splitMix64(key)) & (CAPACITY - 1);
+        while (entries[slot].generation == generation && entries[slot].key != key) slot = (slot + 1) & (CAPACITY - 1);
 
-    Match(double r_agent, double l_agent, double r_bot, double l_bot, int n)
-        : agent(r_agent, l_agent, { 10.0, 0.0 }),
-        bot(r_bot, l_bot, { 10.0, 10.0 }),
-        court(20.0, 10.0, n),
-        strategy(n) {
-        rng.seed(std::random_device{}());
+        Entry& entry = entries[slot];
+        if (entry.generation != generation) {
+            used++;
+            entry.generation = generation;
+            entry.key = key;
+            entry.candidateCount = 0;
+            entry.agentPos = agentPos;
+            entry.botPos = botPos;
+            entry.best = bestGreedySquare(court, agentPos, agentR, botPos);
+            return entry.best;
+        }
+        stats.hits++;
+
+        bool samePoint = entry.agentPos.x == agentPos.x && entry.agentPos.y == agentPos.y
+            && entry.botPos.x == botPos.x && entry.botPos.y == botPos.y;
+        if (!exact || samePoint) return entry.best;
+        if (entry.candidateCount == 0) return scoreCandidates(court, agentPos, agentR, botPos, entry);
+        if (entry.margin > 2.0 * errorBound) {
+            stats.rescores++;
+            return rescoreCandidates(court, agentPos, agentR, botPos, entry);
+        }
+        stats.fallbacks++;
+        return bestGreedySquare(court, agentPos, agentR, botPos);
     }
 
-    bool simulatePoint(bool serve = false) {
-        Square targetSquare = strategy.chooseSquare(agent, bot, court, rng, serve);
+private:
+    static const int CANDIDATES = 8;
 
-        if (targetSquare.row == -1) {
-            return false;
-        }
+    struct Entry {
+        std::uint64_t key = 0;
+        std::uint32_t generation = 0;
+        int best = 0;
+        int candidateCount = 0;
+        int candidates[CANDIDATES];
+        double margin = 0.0;
+        Position agentPos;
+        Position botPos;
+    };
 
-        std::uniform_real_distribution<double> noise(-targetSquare.size / 2.0, targetSquare.size / 2.0);
-        Position ball = { targetSquare.center.x + noise(rng), targetSquare.center.y + noise(rng) };
+    static const size_t CAPACITY = 1 << 14;
+    static const int CELL_LIMIT = 1 << 15;
+    std::vector<Entry> entries;
+    std::vector<double> scores;
+    size_t used = 0;
+    std::uint32_t generation = 1;
+    const Court* boundCourt = nullptr;
+    double boundR = 0.0;
+    double errorBound = 0.0;
 
-        if (court.isOut(ball)) {
-            return false;
+    bool quantize(const Position& agentPos, const Position& botPos, std::uint64_t& key) const {
+        double coords[4] = { agentPos.x, agentPos.y, botPos.x, botPos.y };
+        key = 1;
+        for (double coord : coords) {
+            double cell = std::floor(coord / step);
+            if (!(cell >= 0.0 && cell < CELL_LIMIT)) return false;
+            key = (key << 15) | static_cast<std::uint64_t>(cell);
         }
+        return true;
+    }
 
-        bot.moveTo(ball);
-        if (!bot.canHit(ball)) {
-            return true; 
+    int scoreCandidates(const Court& court, const Position& agentPos, double agentR, const Position& botPos, Entry& entry) {
+        int count = static_cast<int>(court.centerX.size());
+        scores.resize(count);
+        greedySquareScores(court.centerX.data(), court.centerY.data(), count, agentPos, agentR, botPos, scores.data());
+        double topScore[CANDIDATES + 1];
+        int topIndex[CANDIDATES + 1] = {};
+        int kept = 0;
+        for (int k = 0; k < count; k++) {
+            double score = scores[k];
+            if (kept == CANDIDATES + 1 && score <= topScore[CANDIDATES]) continue;
+            int at = kept < CANDIDATES + 1 ? kept++ : CANDIDATES;
+            while (at > 0 && topScore[at - 1] < score) {
+                topScore[at] = topScore[at - 1];
+                topIndex[at] = topIndex[at - 1];
+                at--;
+            }
+            topScore[at] = score;
+            topIndex[at] = k;
         }
+        entry.best = topIndex[0];
+        entry.candidateCount = std::min(kept, CANDIDATES);
+        std::copy(topIndex, topIndex + entry.candidateCount, entry.candidates);
+        std::sort(entry.candidates, entry.candidates + entry.candidateCount);
+        entry.margin = kept > CANDIDATES ? topScore[0] - topScore[CANDIDATES] : HUGE_VAL;
+        entry.agentPos = agentPos;
+        entry.botPos = botPos;
+        return entry.best;
+    }
 
-        std::uniform_real_distribution<double> xDist(0.0, court.width);
-        std::uniform_real_distribution<double> yDist(0.0, court.height / 2.0);
-        Position returnBall = { xDist(rng), yDist(rng) };
-
-        if (court.isOut(returnBall)) {
-            return true; 
+    int rescoreCandidates(const Court& court, const Position& agentPos, double agentR, const Position& botPos,
+        const Entry& entry) const {
+        double best = -1.0;
+        int bestAt = entry.candidates[0];
+        for (int c = 0; c < entry.candidateCount; c++) {
+            int k = entry.candidates[c];
+            double score = greedySquareScore(court.centerX[k], court.centerY[k], agentPos, agentR, botPos);
+            if (score > best) {
+                best = score;
+                bestAt = k;
+            }
         }
+        return bestAt;
+    }
+};
 
-        agent.moveTo(returnBall);
-        if (!agent.canHit(returnBall)) {
-            return false;
+template <class Random>
+Square perturbedGreedySquare(int best, const Court& court, Random& random, double errorProb) {
+    if (random.uniform(0.0, 1.0) < errorProb) {
+        LAB3_COUNT(errorPerturbations);
+        int dRow[] = { -1, 0, 1, 0 };
+        int dCol[] = { 0, -1, 0, 1 };
+        int dirIndex = random.below(4);
+        int newRow = best / court.n + dRow[dirIndex];
+        int newCol = best % court.n + dCol[dirIndex];
+        if (newRow < 0 || newRow >= court.n || newCol < 0 || newCol >= court.n) {
+            LAB3_COUNT(errorOffCourt);
+            return Square{ {-1.0, -1.0}, 0.0, -1, -1 };
         }
+        best = newRow * court.n + newCol;
+    }
+
+    return court.squares[best];
+}
+
+inline double greedyCellBound(double cx, double cy, double halfX, double halfY,
+    const Position& agentPos, double agentR, const Position& botPos, double separation) {
+    double bx = std::abs(cx - botPos.x) + halfX, by = std::abs(cy - botPos.y) + halfY;
+    double nearX = std::max(0.0, std::abs(cx - agentPos.x) - halfX), nearY = std::max(0.0, std::abs(cy - agentPos.y) - halfY);
+    double farX = std::abs(cx - agentPos.x) + halfX, farY = std::abs(cy - agentPos.y) + halfY;
+    double nearest = std::sqrt(nearX * nearX + nearY * nearY), farthest = std::sqrt(farX * farX + farY * farY);
+    auto viaAgent = [&](double d) { return (d + separation) * std::min(1.0, agentR / (d + 0.1)); };
+    double saturation = std::min(farthest, std::max(nearest, agentR - 0.1));
+    double triangle = std::max(viaAgent(saturation), std::max(viaAgent(nearest), viaAgent(farthest)));
+    double direct = std::sqrt(bx * bx + by * by) * std::min(1.0, agentR / (nearest + 0.1));
+    return std::min(direct, triangle) * (1.0 + 1e-12);
+}
 
-        return simulatePoint(false);
+class HierarchicalGreedySearch {
+public:
+    void bind(const Court& coarse, const Court& fine) {
+        if (coarseCourt == &coarse && fineCourt == &fine) return;
+        coarseCourt = &coarse;
+        fineCourt = &fine;
+        rowBegin = cellRanges(fine.n, fine.width / fine.n, coarse.n, coarse.width / coarse.n);
+        colBegin = cellRanges(fine.n, fine.height / fine.n, coarse.n, coarse.height / coarse.n);
+        int widest = LEAF_SQUARES;
+        for (int c = 0; c < coarse.n; c++) widest = std::max(widest, colBegin[c + 1] - colBegin[c]);
+        scores.resize(widest);
     }
 
-    void playGame(bool firstServe = true) {
-        agentPoints = 0;
-        botPoints = 0;
-        while (true) {
-            bool serveNow = (agentPoints + botPoints == 0) && firstServe;
-            bool agentWonPoint = simulatePoint(serveNow);
+    int best(const Position& agentPos, double agentR, const Position& botPos) {
+        const Court& coarse = *coarseCourt;
+        int first = bestGreedySquare(coarse, agentPos, agentR, botPos);
+        bestScore = -1.0;
+        bestAt = 0;
+        double dx = agentPos.x - botPos.x, dy = agentPos.y - botPos.y;
+        separation = std::sqrt(dx * dx + dy * dy);
+        int row = first / coarse.n, col = first % coarse.n;
+        scanBlock(rowBegin[row], rowBegin[row + 1], colBegin[col], colBegin[col + 1], agentPos, agentR, botPos);
+        searchBlock(0, fineCourt->n, 0, fineCourt->n, blockBound(0, fineCourt->n, 0, fineCourt->n, agentPos, agentR, botPos),
+            agentPos, agentR, botPos);
+        return bestAt;
+    }
 
-            if (agentWonPoint) agentPoints++;
-            else botPoints++;
+private:
+    static const int LEAF_SQUARES = 32;
+    const Court* coarseCourt = nullptr;
+    const Court* fineCourt = nullptr;
+    std::vector<int> rowBegin;
+    std::vector<int> colBegin;
+    std::vector<double> scores;
+    double separation = 0.0;
+    double bestScore = -1.0;
+    int bestAt = 0;
 
-            if (agentPoints >= 4 && agentPoints - botPoints >= 2) {
-                agentGames++;
-                break;
-            }
-            if (botPoints >= 4 && botPoints - agentPoints >= 2) {
-                botGames++;
-                break;
-            }
+    static std::vector<int> cellRanges(int fineCount, double fineSize, int coarseCount, double coarseSize) {
+        std::vector<int> begin(coarseCount + 1, fineCount);
+        for (int i = fineCount - 1; i >= 0; i--) {
+            int owner = std::min(coarseCount - 1, static_cast<int>((i + 0.5) * fineSize / coarseSize));
+            begin[owner] = i;
         }
+        for (int c = coarseCount - 1; c >= 0; c--) begin[c] = std::min(begin[c], begin[c + 1]);
+        return begin;
     }
 
-    void playSet() {
-        agentGames = 0;
-        botGames = 0;
-        while (true) {
-            playGame();
-            if (agentGames >= 6 && agentGames - botGames >= 2) {
-                agentSets++;
-                break;
-            }
-            if (botGames >= 6 && botGames - agentGames >= 2) {
-                botSets++;
-                break;
+    double blockBound(int rowFirst, int rowEnd, int colFirst, int colEnd,
+        const Position& agentPos, double agentR, const Position& botPos) const {
+        const Court& fine = *fineCourt;
+        double sizeX = fine.width / fine.n, sizeY = fine.height / fine.n;
+        return greedyCellBound((rowFirst + rowEnd) * sizeX / 2.0, (colFirst + colEnd) * sizeY / 2.0,
+            (rowEnd - rowFirst - 1) * sizeX / 2.0, (colEnd - colFirst - 1) * sizeY / 2.0, agentPos, agentR, botPos, separation);
+    }
+
+    void searchBlock(int rowFirst, int rowEnd, int colFirst, int colEnd, double bound,
+        const Position& agentPos, double agentR, const Position& botPos) {
+        if (bound < bestScore) return;
+        int rows = rowEnd - rowFirst, cols = colEnd - colFirst;
+        if (rows * cols <= LEAF_SQUARES) {
+            scanBlock(rowFirst, rowEnd, colFirst, colEnd, agentPos, agentR, botPos);
+            return;
+        }
+        int lowRowEnd = rowEnd, highRowFirst = rowFirst, lowColEnd = colEnd, highColFirst = colFirst;
+        if (rows * fineCourt->width >= cols * fineCourt->height) lowRowEnd = highRowFirst = rowFirst + rows / 2;
+        else lowColEnd = highColFirst = colFirst + cols / 2;
+        double lowBound = blockBound(rowFirst, lowRowEnd, colFirst, lowColEnd, agentPos, agentR, botPos);
+        double highBound = blockBound(highRowFirst, rowEnd, highColFirst, colEnd, agentPos, agentR, botPos);
+        if (lowBound >= highBound) {
+            searchBlock(rowFirst, lowRowEnd, colFirst, lowColEnd, lowBound, agentPos, agentR, botPos);
+            searchBlock(highRowFirst, rowEnd, highColFirst, colEnd, highBound, agentPos, agentR, botPos);
+        }
+        else {
+            searchBlock(highRowFirst, rowEnd, highColFirst, colEnd, highBound, agentPos, agentR, botPos);
+            searchBlock(rowFirst, lowRowEnd, colFirst, lowColEnd, lowBound, agentPos, agentR, botPos);
+        }
+    }
+
+    void scanBlock(int rowFirst, int rowEnd, int colFirst, int colEnd,
+        const Position& agentPos, double agentR, const Position& botPos) {
+        const Court& fine = *fineCourt;
+        int count = colEnd - colFirst;
+        for (int i = rowFirst; i < rowEnd; i++) {
+            int base = i * fine.n + colFirst;
+            greedySquareScores(fine.centerX.data() + base, fine.centerY.data() + base, count, agentPos, agentR, botPos, scores.data());
+            for (int j = 0; j < count; j++) {
+                if (scores[j] > bestScore || (scores[j] == bestScore && base + j < bestAt)) {
+                    bestScore = scores[j];
+                    bestAt = base + j;
+                }
             }
         }
     }
+};
 
-    void playMatch(int bestOfSets) {
-        agentSets = 0;
-        botSets = 0;
-        while (agentSets < bestOfSets && botSets < bestOfSets) {
-            playSet();
+struct GridAim {
+    const Court& targetGrid(const Court& court) {
+        return court;
+    }
+
+    template <class Random>
+    Square choose(const Player& agent, const Player& bot, const Court& court, Random& random, double errorProb) {
+        return perturbedGreedySquare(bestGreedySquare(court, agent.pos, agent.r, bot.pos), court, random, errorProb);
+    }
+};
+
+struct CachedGridAim {
+    BestSquareCache* squareCache = nullptr;
+
+    const Court& targetGrid(const Court& court) {
+        return court;
+    }
+
+    template <class Random>
+    Square choose(const Player& agent, const Player& bot, const Court& court, Random& random, double errorProb) {
+        return perturbedGreedySquare(squareCache->bestSquare(court, agent.pos, agent.r, bot.pos), court, random, errorProb);
+    }
+};
+
+struct HierarchicalAim {
+    int aimResolution = 0;
+    std::shared_ptr<const Court> grid;
+    HierarchicalGreedySearch search;
+
+    const Court& targetGrid(const Court& court) {
+        if (!grid || grid->width != court.width || grid->height != court.height) {
+            grid = Court::cached(court.width, court.height, aimResolution);
         }
+        return *grid;
+    }
+
+    template <class Random>
+    Square choose(const Player& agent, const Player& bot, const Court& court, Random& random, double errorProb) {
+        const Court& fine = targetGrid(court);
+        search.bind(court, fine);
+        return perturbedGreedySquare(search.best(agent.pos, agent.r, bot.pos), fine, random, errorProb);
     }
 };
 
-int main() {
-    setlocale(LC_ALL, "Russian");
-    const int simulations = 100;
-    const int bestOfSets = 2;
+template <class AimPolicy = GridAim, bool VALIDATE_GRID_LOOKUP = false>
+class TrapStrategy {
+public:
+    double errorProb = 0.05;
+    int n;
+
+    bool trapMode = false;      
+    Position lastServeTarget;    
+    bool hasLastTarget = false;  
 
-    const int n = 10;
+    long long gridLookupMismatches = 0;
+    AimPolicy aim;
 
-    const double r_robot = 2.0;
-    const double l_robot = 3.0;
+    TrapStrategy(int n) : n(n) {}
 
-    std::ofstream results("results.csv");
-    results << "r_agent;l_agent;n;agentWins;botWins;agentWinProbability\n";
+    void resetState() {
+        trapMode = false;
+        hasLastTarget = false;
+    }
 
-    std::cout << "---------------------------------------------------------\n";
-    std::cout << "        МОДЕЛИРОВАНИЕ МАТЧЕЙ: АГЕНТ против БОЛВАНЧИКА   \n";
-    std::cout << "---------------------------------------------------------\n\n";
+    int nearestSquare(const Court& court, const Position& p) {
+        int index = court.nearestSquareIndex(p);
+        if (VALIDATE_GRID_LOOKUP) index = checkedLookup(index, extremeDistanceSquare(court, p, false));
+        return index;
+    }
 
-    for (int n = 5; n <= 15; n += 5) {
-        std::cout << "==================== ПАРАМЕТР n = " << n << " ====================\n";
-        for (double r_agent = 1.0; r_agent <= 2.0; r_agent += 1.0) {
-            for (double l_agent = 1.0; l_agent <= 3.0; l_agent += 1.0) {
-                int agentWinCount = 0;
-                int botWinCount = 0;
+    int farthestSquare(const Court& court, const Position& p) {
+        int index = court.farthestSquareIndex(p);
+        if (VALIDATE_GRID_LOOKUP) index = checkedLookup(index, extremeDistanceSquare(court, p, true));
+        return index;
+    }
 
-                for (int i = 0; i < simulations; i++) {
-                    Match match(r_agent, l_agent, r_robot, l_robot, n);
-                    match.playMatch(bestOfSets);
+    int checkedLookup(int closedForm, int scanned) {
+        if (closedForm == scanned) return closedForm;
+        gridLookupMismatches++;
+        return scanned;
+    }
 
-                    if (match.agentSets > match.botSets) agentWinCount++;
-                    else botWinCount++;
-                }
+    template <class Random>
+    Square chooseSquare(const Player& agent, const Player& bot, const Court& court,
+        Random& random, bool isServe = false) {
+        if (trapMode && hasLastTarget) {
+            trapMode = false; 
+            hasLastTarget = false;
+            const Court& grid = aim.targetGrid(court);
+            return grid.squares[farthestSquare(grid, lastServeTarget)];
+        }
 
-                double winProbability = static_cast<double>(agentWinCount) / simulations;
-                results << std::fixed << std::setprecision(2)
-                    << r_agent << ";" << l_agent << ";" << n << ";"
-                    << agentWinCount << ";" << botWinCount << ";"
-                    << winProbability << "\n";
+        if (isServe) {
+            const Court& grid = aim.targetGrid(court);
+            Square nearSquare = grid.squares[nearestSquare(grid, bot.pos)];
 
-                std::cout << std::fixed << std::setprecision(2)
-                    << "- Радиус действия агента r = " << r_agent
-                    << ", Макс. перемещение l = " << l_agent << "\n"
-                    << "   Побед агента: " << agentWinCount
-                    << " из " << simulations
-                    << " (" << winProbability * 100 << "%)\n\n";
-            }
+            lastServeTarget = nearSquare.center;
+            hasLastTarget = true;
+            trapMode = true; 
+            return nearSquare;
         }
+
+        return aim.choose(agent, bot, court, random, errorProb);
+    }
+};
+
+using Strategy = TrapStrategy<>;
+
+template <class AimPolicy = GridAim>
+class GreedyStrategy {
+public:
+    double errorProb = 0.05;
+    int n;
+    AimPolicy aim;
+
+    GreedyStrategy(int n) : n(n) {}
+
+    void resetState() {}
+
+    template <class Random>
+    Square chooseSquare(const Player& agent, const Player& bot, const Court& court, Random& random, bool = false) {
+        return aim.choose(agent, bot, court, random, errorProb);
     }
+};
+
+class RandomStrategy {
+public:
+    int n;
 
-    results.close();
-    std::cout << "Симуляция завершена. Результаты в results.csv\n";
+    RandomStrategy(int n) : n(n) {}
+
+    void resetState() {}
+
+    template <class Random>
+    Square chooseSquare(const Player&, const Player&, const Court& court, Random& random, bool = false) {
+        return court.squares[random.below(static_cast<int>(court.squares.size()))];
+    }
+};
+
+template <class StrategyPolicy>
+auto attachSquareCache(StrategyPolicy& strategy, BestSquareCache* cache, int) -> decltype(strategy.aim.squareCache = cache, void()) {
+    strategy.aim.squareCache = cache;
+}
+
+template <class StrategyPolicy>
+void attachSquareCache(StrategyPolicy&, BestSquareCache*, long) {}
+
+template <class StrategyPolicy>
+auto setAimResolution(StrategyPolicy& strategy, int resolution, int) -> decltype(strategy.aim.aimResolution = resolution, void()) {
+    strategy.aim.aimResolution = resolution;
+}
+
+template <class StrategyPolicy>
+void setAimResolution(StrategyPolicy&, int, long) {}
+
+struct RallyStats {
+    long long points = 0;
+    long long shots = 0;
+    int longestRally = 0;
+
+    void record(int rallyLength) {
+        points++;
+        shots += rallyLength;
+        longestRally = std::max(longestRally, rallyLength);
+    }
+
+    void merge(const RallyStats& other) {
+        points += other.points;
+        shots += other.shots;
+        longestRally = std::max(longestRally, other.longestRally);
+    }
+
+    double meanRally() const {
+        return points ? static_cast<double>(shots) / points : 0.0;
+    }
+};
+
+struct PointEstimate {
+    static const int STATES = 18;
+    long long points[STATES] = {};
+    long long wins[STATES] = {};
+
+    static int state(int agentPoints, int botPoints) {
+        if (agentPoints >= 3 && botPoints >= 3) {
+            if (agentPoints == botPoints) return 15;
+            return agentPoints > botPoints ? 16 : 17;
+        }
+        return agentPoints * 4 + botPoints;
+    }
+
+    void record(int agentPoints, int botPoints, bool agentWon) {
+        int k = state(agentPoints, botPoints);
+        points[k]++;
+        wins[k] += agentWon;
+    }
+
+    void merge(const PointEstimate& other) {
+        for (int k = 0; k < STATES; k++) {
+            points[k] += other.points[k];
+            wins[k] += other.wins[k];
+        }
+    }
+
+    long long totalPoints(int from = 0) const {
+        long long total = 0;
+        for (int k = from; k < STATES; k++) total += points[k];
+        return total;
+    }
+
+    long long totalWins(int from = 0) const {
+        long long total = 0;
+        for (int k = from; k < STATES; k++) total += wins[k];
+        return total;
+    }
+};
+
+struct Interval {
+    double low, high;
+};
+
+inline Interval wilsonInterval(long long wins, long long total, double z = 1.96) {
+    if (total == 0) return { 0.0, 1.0 };
+    double p = static_cast<double>(wins) / total;
+    double z2n = z * z / total;
+    double center = (p + z2n / 2.0) / (1.0 + z2n);
+    double halfWidth = z * std::sqrt(p * (1.0 - p) / total + z2n / (4.0 * total)) / (1.0 + z2n);
+    return { std::max(0.0, center - halfWidth), std::min(1.0, center + halfWidth) };
+}
+
+inline double decidingRunProbability(double p) {
+    double q = 1.0 - p;
+    return p * p + q * q > 0.0 ? p * p / (p * p + q * q) : 0.5;
+}
+
+inline double gameWinFrom(int a, int b, const double* p, double deuce) {
+    if (a == 4) return 1.0;
+    if (b == 4) return 0.0;
+    if (a == 3 && b == 3) return deuce;
+    double pa = p[PointEstimate::state(a, b)];
+    return pa * gameWinFrom(a + 1, b, p, deuce) + (1.0 - pa) * gameWinFrom(a, b + 1, p, deuce);
+}
+
+inline double gameWinProbability(const double* p) {
+    double pDeuce = p[15], pAdvantage = p[16], pBehind = p[17];
+    double reset = pDeuce * (1.0 - pAdvantage) + (1.0 - pDeuce) * pBehind;
+    double deuce = reset < 1.0 ? pDeuce * pAdvantage / (1.0 - reset) : 0.5;
+    return gameWinFrom(0, 0, p, deuce);
+}
+
+inline double setWinFrom(int a, int b, double g) {
+    if (a >= 6 && a - b >= 2) return 1.0;
+    if (b >= 6 && b - a >= 2) return 0.0;
+    if (a == b && a >= 5) return decidingRunProbability(g);
+    return g * setWinFrom(a + 1, b, g) + (1.0 - g) * setWinFrom(a, b + 1, g);
+}
+
+inline double matchWinFrom(int a, int b, double s, int bestOfSets) {
+    if (a >= bestOfSets) return 1.0;
+    if (b >= bestOfSets) return 0.0;
+    return s * matchWinFrom(a + 1, b, s, bestOfSets) + (1.0 - s) * matchWinFrom(a, b + 1, s, bestOfSets);
+}
+
+inline double matchWinProbability(const double* p, int bestOfSets) {
+    double set = setWinFrom(0, 0, gameWinProbability(p));
+    return matchWinFrom(0, 0, set, bestOfSets);
+}
+
+template <class Rng = std::default_random_engine, class StrategyPolicy = Strategy>
+class Match {
+public:
+    static constexpr Position AGENT_START = { 10.0, 0.0 };
+    static constexpr Position BOT_START = { 10.0, 10.0 };
+
+    Player agent;
+    Player bot;
+    std::shared_ptr<const Court> courtGeometry;
+    const Court& court;
+    StrategyPolicy strategy;
+    RandomSource<Rng> random;
+    RallyStats* rallyStats = nullptr;
+
+    int agentPoints = 0, botPoints = 0;
+    int agentGames = 0, botGames = 0;
+    int agentSets = 0, botSets = 0;
+
+    Match(double r_agent, double l_agent, double r_bot, double l_bot, int n)
+        : Match(r_agent, l_agent, r_bot, l_bot, n, std::random_device{}()) {}
+
+    Match(double r_agent, double l_agent, double r_bot, double l_bot, int n, std::uint64_t seed)
+        : agent(r_agent, l_agent, AGENT_START),
+        bot(r_bot, l_bot, BOT_START),
+        courtGeometry(Court::cached(20.0, 10.0, n)),
+        court(*courtGeometry),
+        strategy(n) {
+        reseed(seed);
+    }
+
+    void reset(std::uint64_t seed) {
+        agent.pos = AGENT_START;
+        bot.pos = BOT_START;
+        strategy.resetState();
+        agentPoints = botPoints = 0;
+        agentGames = botGames = 0;
+        agentSets = botSets = 0;
+        reseed(seed);
+    }
+
+    void reset(double r_agent, double l_agent, double r_bot, double l_bot, std::uint64_t seed) {
+        agent.r = r_agent;
+        agent.l = l_agent;
+        bot.r = r_bot;
+        bot.l = l_bot;
+        reset(seed);
+    }
+
+    void reseed(std::uint64_t seed) {
+        random.seed(seed);
+    }
+
+    bool simulatePoint(bool serve = false) {
+        int shots = 0;
+        LAB3_TIME_BEGIN(rally);
+        bool agentWon = playRally(serve, shots);
+        LAB3_TIME_END(rally, rallyCycles);
+        LAB3_COUNT(points);
+        LAB3_COUNT_ADD(shots, shots);
+        if (rallyStats) rallyStats->record(shots);
+        return agentWon;
+    }
+
+    bool playRally(bool serve, int& shots) {
+        while (true) {
+            shots++;
+            LAB3_TIME_BEGIN(choose);
+            Square targetSquare = strategy.chooseSquare(agent, bot, court, random, serve);
+            LAB3_TIME_END(choose, chooseCycles);
+            serve = false;
+
+            if (targetSquare.row == -1) {
+                return false;
+            }
+
+            double halfSize = targetSquare.size / 2.0;
+            Position ball = { targetSquare.center.x + random.uniform(-halfSize, halfSize),
+                targetSquare.center.y + random.uniform(-halfSize, halfSize) };
+
+            if (court.isOut(ball)) {
+                LAB3_COUNT(agentOutBalls);
+                return false;
+            }
+
+            LAB3_TIME_BEGIN(botMove);
+            bot.moveTo(ball);
+            LAB3_TIME_END(botMove, moveCycles);
+            if (!bot.canHit(ball)) {
+                LAB3_COUNT(botMisses);
+                return true; 
+            }
+
+            Position returnBall = { random.uniform(0.0, court.width), random.uniform(0.0, court.height / 2.0) };
+
+            if (court.isOut(returnBall)) {
+                LAB3_COUNT(botOutBalls);
+                return true; 
+            }
+
+            LAB3_TIME_BEGIN(agentMove);
+            agent.moveTo(returnBall);
+            LAB3_TIME_END(agentMove, moveCycles);
+            if (!agent.canHit(returnBall)) {
+                LAB3_COUNT(agentMisses);
+                return false;
+            }
+        }
+    }
+
+    void playGame(bool firstServe = true) {
+        agentPoints = 0;
+        botPoints = 0;
+        while (true) {
+            bool serveNow = (agentPoints + botPoints == 0) && firstServe;
+            bool agentWonPoint = simulatePoint(serveNow);
+
+            if (agentWonPoint) agentPoints++;
+            else botPoints++;
+
+            if (agentPoints >= 4 && agentPoints - botPoints >= 2) {
+                agentGames++;
+                break;
+            }
+            if (botPoints >= 4 && botPoints - agentPoints >= 2) {
+                botGames++;
+                break;
+            }
+        }
+    }
+
+    void playSet() {
+        agentGames = 0;
+        botGames = 0;
+        while (true) {
+            playGame();
+            if (agentGames >= 6 && agentGames - botGames >= 2) {
+                agentSets++;
+                break;
+            }
+            if (botGames >= 6 && botGames - agentGames >= 2) {
+                botSets++;
+                break;
+            }
+        }
+    }
+
+    void samplePoints(int count, PointEstimate& estimate) {
+        agentPoints = 0;
+        botPoints = 0;
+        for (int k = 0; k < count; k++) {
+            bool agentWonPoint = simulatePoint(agentPoints + botPoints == 0);
+            estimate.record(agentPoints, botPoints, agentWonPoint);
+
+            if (agentWonPoint) agentPoints++;
+            else botPoints++;
+
+            if ((agentPoints >= 4 && agentPoints - botPoints >= 2) || (botPoints >= 4 && botPoints - agentPoints >= 2)) {
+                agentPoints = 0;
+                botPoints = 0;
+            }
+        }
+    }
+
+    void playMatch(int bestOfSets) {
+        agentSets = 0;
+        botSets = 0;
+        while (agentSets < bestOfSets && botSets < bestOfSets) {
+            playSet();
+        }
+    }
+};
+
+template <class Rng = std::default_random_engine, class StrategyPolicy = Strategy, int LANES = 8>
+class MatchBatch {
+public:
+    std::shared_ptr<const Court> courtGeometry;
+    const Court& court;
+    std::vector<StrategyPolicy> strategies;
+    RandomSource<Rng> random[LANES];
+    RallyStats* rallyStats = nullptr;
+
+    double agentX[LANES], agentY[LANES], agentR[LANES], agentL[LANES];
+    double botX[LANES], botY[LANES], botR[LANES], botL[LANES];
+    double ballX[LANES], ballY[LANES];
+    int agentPoints[LANES], botPoints[LANES];
+    int agentGames[LANES], botGames[LANES];
+    int agentSets[LANES], botSets[LANES];
+    int shots[LANES];
+    int replica[LANES];
+    char serve[LANES];
+    char active[LANES];
+    char live[LANES];
+    char reached[LANES];
+
+    explicit MatchBatch(int n)
+        : courtGeometry(Court::cached(20.0, 10.0, n)),
+        court(*courtGeometry),
+        strategies(LANES, StrategyPolicy(n)) {
+        std::fill(active, active + LANES, 0);
+    }
+
+    template <class SeedFor, class OnFinished>
+    void run(double r_agent, double l_agent, double r_bot, double l_bot, int bestOfSets,
+        int first, int last, SeedFor seedFor, OnFinished onFinished) {
+        int next = first;
+        int activeCount = 0;
+        for (int lane = 0; lane < LANES; lane++) {
+            active[lane] = next < last;
+            if (!active[lane]) continue;
+            load(lane, r_agent, l_agent, r_bot, l_bot, next, seedFor(next));
+            next++;
+            activeCount++;
+        }
+
+        auto finishPoint = [&](int lane, bool agentWon) {
+            LAB3_COUNT(points);
+            LAB3_COUNT_ADD(shots, shots[lane]);
+            if (rallyStats) rallyStats->record(shots[lane]);
+            shots[lane] = 0;
+            if (!scorePoint(lane, agentWon, bestOfSets)) return;
+            onFinished(replica[lane], agentSets[lane] > botSets[lane]);
+            if (next < last) {
+                load(lane, r_agent, l_agent, r_bot, l_bot, next, seedFor(next));
+                next++;
+            }
+            else {
+                active[lane] = 0;
+                activeCount--;
+            }
+        };
+
+        LAB3_TIME_BEGIN(rally);
+        while (activeCount > 0) {
+            for (int lane = 0; lane < LANES; lane++) {
+                live[lane] = 0;
+                if (!active[lane]) continue;
+                shots[lane]++;
+                Player agentView(agentR[lane], agentL[lane], { agentX[lane], agentY[lane] });
+                Player botView(botR[lane], botL[lane], { botX[lane], botY[lane] });
+                LAB3_TIME_BEGIN(choose);
+                Square target = strategies[lane].chooseSquare(agentView, botView, court, random[lane], serve[lane] != 0);
+                LAB3_TIME_END(choose, chooseCycles);
+                serve[lane] = 0;
+                if (target.row == -1) {
+                    finishPoint(lane, false);
+                    continue;
+                }
+                double halfSize = target.size / 2.0;
+                ballX[lane] = target.center.x + random[lane].uniform(-halfSize, halfSize);
+                ballY[lane] = target.center.y + random[lane].uniform(-halfSize, halfSize);
+                if (court.isOut({ ballX[lane], ballY[lane] })) {
+                    LAB3_COUNT(agentOutBalls);
+                    finishPoint(lane, false);
+                }
+                else live[lane] = 1;
+            }
+
+            LAB3_TIME_BEGIN(botMove);
+            moveAndReach(botX, botY, botR, botL, ballX, ballY, live, reached, LANES);
+            LAB3_TIME_END(botMove, moveCycles);
+
+            for (int lane = 0; lane < LANES; lane++) {
+                if (!live[lane]) continue;
+                live[lane] = 0;
+                if (!reached[lane]) {
+                    LAB3_COUNT(botMisses);
+                    finishPoint(lane, true);
+                    continue;
+                }
+                ballX[lane] = random[lane].uniform(0.0, court.width);
+                ballY[lane] = random[lane].uniform(0.0, court.height / 2.0);
+                if (court.isOut({ ballX[lane], ballY[lane] })) {
+                    LAB3_COUNT(botOutBalls);
+                    finishPoint(lane, true);
+                }
+                else live[lane] = 1;
+            }
+
+            LAB3_TIME_BEGIN(agentMove);
+            moveAndReach(agentX, agentY, agentR, agentL, ballX, ballY, live, reached, LANES);
+            LAB3_TIME_END(agentMove, moveCycles);
+
+            for (int lane = 0; lane < LANES; lane++) {
+                if (live[lane] && !reached[lane]) {
+                    LAB3_COUNT(agentMisses);
+                    finishPoint(lane, false);
+                }
+            }
+        }
+        LAB3_TIME_END(rally, rallyCycles);
+    }
+
+private:
+    void load(int lane, double r_agent, double l_agent, double r_bot, double l_bot, int replicaIndex, std::uint64_t seed) {
+        agentX[lane] = Match<Rng, StrategyPolicy>::AGENT_START.x;
+        agentY[lane] = Match<Rng, StrategyPolicy>::AGENT_START.y;
+        botX[lane] = Match<Rng, StrategyPolicy>::BOT_START.x;
+        botY[lane] = Match<Rng, StrategyPolicy>::BOT_START.y;
+        agentR[lane] = r_agent;
+        agentL[lane] = l_agent;
+        botR[lane] = r_bot;
+        botL[lane] = l_bot;
+        agentPoints[lane] = botPoints[lane] = 0;
+        agentGames[lane] = botGames[lane] = 0;
+        agentSets[lane] = botSets[lane] = 0;
+        shots[lane] = 0;
+        serve[lane] = 1;
+        replica[lane] = replicaIndex;
+        strategies[lane].resetState();
+        random[lane].seed(seed);
+    }
+
+    bool scorePoint(int lane, bool agentWon, int bestOfSets) {
+        if (agentWon) agentPoints[lane]++;
+        else botPoints[lane]++;
+
+        int& a = agentPoints[lane];
+        int& b = botPoints[lane];
+        if (a >= 4 && a - b >= 2) agentGames[lane]++;
+        else if (b >= 4 && b - a >= 2) botGames[lane]++;
+        else return false;
+        a = b = 0;
+        serve[lane] = 1;
+
+        int& ag = agentGames[lane];
+        int& bg = botGames[lane];
+        if (ag >= 6 && ag - bg >= 2) agentSets[lane]++;
+        else if (bg >= 6 && bg - ag >= 2) botSets[lane]++;
+        else return false;
+        ag = bg = 0;
+
+        return agentSets[lane] >= bestOfSets || botSets[lane] >= bestOfSets;
+    }
+};
+
+class WorkStealingPool {
+public:
+    using Task = std::function<void(int)>;
+
+    explicit WorkStealingPool(int threadCount) : queues(std::max(1, threadCount)) {}
+
+    int size() const {
+        return static_cast<int>(queues.size());
+    }
+
+    void run(std::vector<Task>& tasks) {
+        for (size_t t = 0; t < tasks.size(); t++) {
+            queues[t % queues.size()].tasks.push_back(std::move(tasks[t]));
+        }
+
+        std::vector<std::thread> workers;
+        for (int w = 1; w < size(); w++) {
+            workers.emplace_back([this, w] { workerLoop(w); });
+        }
+        workerLoop(0);
+        for (auto& worker : workers) worker.join();
+    }
+
+private:
+    struct WorkQueue {
+        std::mutex mtx;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<WorkQueue> queues;
+
+    bool popOwn(int worker, Task& task) {
+        WorkQueue& queue = queues[worker];
+        std::lock_guard<std::mutex> lock(queue.mtx);
+        if (queue.tasks.empty()) return false;
+        task = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+        return true;
+    }
+
+    bool steal(int worker, Task& task) {
+        for (int offset = 1; offset < size(); offset++) {
+            WorkQueue& queue = queues[(worker + offset) % size()];
+            std::lock_guard<std::mutex> lock(queue.mtx);
+            if (queue.tasks.empty()) continue;
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+            return true;
+        }
+        return false;
+    }
+
+    void workerLoop(int worker) {
+        Task task;
+        while (popOwn(worker, task) || steal(worker, task)) {
+            task(worker);
+        }
+    }
+};
+
+struct SweepPoint {
+    int n;
+    double r_agent;
+    double l_agent;
+    double r_robot;
+    double l_robot;
+    std::uint64_t index;
+};
+
+struct SweepAxis {
+    std::string name;
+    std::vector<double> values;
+};
+
+class SweepSpec {
+public:
+    static constexpr const char* AXIS_USAGE =
+        "Ожидается ось=v1,v2,... или ось=начало:конец:количество; n - целые не меньше 1, шаг диапазона не равен 0\n";
+
+    SweepSpec() {
+        axes = { { "n", { 5, 10, 15 } }, { "r_agent", { 1.0, 2.0 } }, { "l_agent", { 1.0, 2.0, 3.0 } },
+            { "r_robot", { 2.0 } }, { "l_robot", { 3.0 } } };
+    }
+
+    bool setAxis(const std::string& name, const std::string& text) {
+        for (auto& axis : axes) {
+            if (axis.name != name) continue;
+            std::vector<double> values;
+            if (!parseValues(text, values)) return false;
+            if (name == "n") {
+                for (double value : values) {
+                    if (value < 1 || value > 1e9 || value != std::floor(value)) return false;
+                }
+            }
+            std::uint64_t others = size() / axis.values.size();
+            if (values.size() > UINT64_MAX / others) return false;
+            axis.values = std::move(values);
+            return true;
+        }
+        return false;
+    }
+
+    bool setAxis(const std::string& assignment) {
+        size_t equals = assignment.find('=');
+        if (equals == std::string::npos) return false;
+        return setAxis(trim(assignment.substr(0, equals)), trim(assignment.substr(equals + 1)));
+    }
+
+    bool load(const std::string& path, std::string& badLine) {
+        std::ifstream in(path);
+        if (!in) return false;
+        std::string line;
+        while (std::getline(in, line)) {
+            line = trim(line);
+            if (line.empty() || line[0] == '#') continue;
+            if (!setAxis(line)) {
+                badLine = line;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::uint64_t size() const {
+        std::uint64_t total = 1;
+        for (const auto& axis : axes) total *= axis.values.size();
+        return total;
+    }
+
+    int largestN() const {
+        return static_cast<int>(std::lround(*std::max_element(axes[0].values.begin(), axes[0].values.end())));
+    }
+
+    SweepPoint at(std::uint64_t index) const {
+        double values[5];
+        std::uint64_t rest = index;
+        for (int k = static_cast<int>(axes.size()) - 1; k >= 0; k--) {
+            std::uint64_t radix = axes[k].values.size();
+            values[k] = axes[k].values[rest % radix];
+            rest /= radix;
+        }
+        return { static_cast<int>(std::lround(values[0])), values[1], values[2], values[3], values[4], index };
+    }
+
+private:
+    std::vector<SweepAxis> axes;
+
+    static std::string trim(const std::string& text) {
+        size_t begin = text.find_first_not_of(" \t\r");
+        if (begin == std::string::npos) return "";
+        size_t end = text.find_last_not_of(" \t\r");
+        return text.substr(begin, end - begin + 1);
+    }
+
+    static bool parseNumber(const std::string& text, double& value) {
+        std::string item = trim(text);
+        size_t used = 0;
+        value = std::stod(item, &used);
+        return used == item.size() && std::isfinite(value);
+    }
+
+    static bool parseValues(const std::string& text, std::vector<double>& values) {
+        try {
+            size_t firstColon = text.find(':');
+            if (firstColon != std::string::npos) {
+                size_t secondColon = text.find(':', firstColon + 1);
+                if (secondColon == std::string::npos) return false;
+                double start, stop, count;
+                if (!parseNumber(text.substr(0, firstColon), start)
+                    || !parseNumber(text.substr(firstColon + 1, secondColon - firstColon - 1), stop)
+                    || !parseNumber(text.substr(secondColon + 1), count)) return false;
+                if (count < 1 || count > 1e9 || count != std::floor(count)) return false;
+                if (count > 1 && start == stop) return false;
+                int points = static_cast<int>(count);
+                for (int k = 0; k < points; k++) {
+                    values.push_back(points == 1 ? start : start + (stop - start) * k / (points - 1));
+                }
+                return true;
+            }
+            size_t begin = 0;
+            while (begin <= text.size()) {
+                size_t comma = text.find(',', begin);
+                if (comma == std::string::npos) comma = text.size();
+                double value;
+                if (!trim(text.substr(begin, comma - begin)).empty()) {
+                    if (!parseNumber(text.substr(begin, comma - begin), value)) return false;
+                    values.push_back(value);
+                }
+                begin = comma + 1;
+            }
+            return !values.empty();
+        }
+        catch (const std::exception&) {
+            return false;
+        }
+    }
+};
+
+struct SweepResult {
+    SweepPoint point;
+    int agentWins = 0;
+    int botWins = 0;
+    int samples = 0;
+    RallyStats rallyStats;
+    MatchCounters counters;
+};
+
+template <class Rng, class StrategyPolicy = Strategy>
+class SweepEngine {
+public:
+    using MatchType = Match<Rng, StrategyPolicy>;
+    using BatchType = MatchBatch<Rng, StrategyPolicy>;
+
+    SweepEngine(int simulations, int bestOfSets, std::uint64_t seed, int threads)
+        : simulations(simulations), bestOfSets(bestOfSets),
+        masterSeed(seed), threads(std::max(1, threads)) {}
+
+    bool collectRallyStats = false;
+    bool batched = false;
+    double targetHalfWidth = 0.0;
+    int sequentialChunk = 256;
+    int replicaBegin = 0;
+    int replicaEnd = -1;
+    bool useSquareCache = false;
+    bool exactSquareCache = true;
+    double squareCacheStep = 0.05;
+    int aimResolution = 0;
+    SquareCacheStats squareCacheStats;
+
+    std::vector<SweepResult> run(const std::vector<SweepPoint>& points) {
+        prepareSquareCaches();
+        std::vector<SweepResult> results(points.size());
+        std::vector<std::mutex> resultLocks(points.size());
+        std::vector<std::map<int, std::unique_ptr<MatchType>>> matchCache(threads);
+        std::vector<std::map<int, std::unique_ptr<BatchType>>> batchCache(threads);
+
+        for (size_t c = 0; c < points.size(); c++) results[c].point = points[c];
+
+        int roundSize = targetHalfWidth > 0.0 ? std::max(1, std::min(simulations, sequentialChunk)) : simulations;
+        while (true) {
+            std::vector<WorkStealingPool::Task> tasks;
+            for (size_t c = 0; c < points.size(); c++) {
+                if (!needsMoreReplicas(results[c])) continue;
+                int roundEnd = std::min(replicaLimit(), replicaBegin + results[c].samples + roundSize);
+                for (int first = replicaBegin + results[c].samples; first < roundEnd; first += REPLICAS_PER_TASK) {
+                    int last = std::min(roundEnd, first + REPLICAS_PER_TASK);
+                    tasks.push_back([&, c, first, last](int worker) {
+                        const SweepPoint& point = points[c];
+                        RallyStats rallyStats;
+                        int agentWins = 0;
+#ifdef LAB3_INSTRUMENT
+                        threadCounters = MatchCounters();
+#endif
+                        if (batched) {
+                            auto& batch = batchCache[worker][point.n];
+                            if (!batch) batch = std::make_unique<BatchType>(point.n);
+                            for (auto& strategy : batch->strategies) configureStrategy(strategy, worker);
+                            batch->rallyStats = collectRallyStats ? &rallyStats : nullptr;
+                            batch->run(point.r_agent, point.l_agent, point.r_robot, point.l_robot, bestOfSets, first, last,
+                                [&](int replica) { return replicaSeed(point.index, replica); },
+                                [&](int, bool agentWon) { if (agentWon) agentWins++; });
+                            batch->rallyStats = nullptr;
+                        }
+                        else {
+                            MatchType& match = cachedMatch(matchCache[worker], point);
+                            configureStrategy(match.strategy, worker);
+                            match.rallyStats = collectRallyStats ? &rallyStats : nullptr;
+                            for (int replica = first; replica < last; replica++) {
+                                match.reset(point.r_agent, point.l_agent, point.r_robot, point.l_robot, replicaSeed(point.index, replica));
+                                match.playMatch(bestOfSets);
+                                if (match.agentSets > match.botSets) agentWins++;
+                            }
+                            match.rallyStats = nullptr;
+                        }
+
+                        std::lock_guard<std::mutex> lock(resultLocks[c]);
+                        results[c].agentWins += agentWins;
+                        results[c].botWins += (last - first) - agentWins;
+                        results[c].rallyStats.merge(rallyStats);
+#ifdef LAB3_INSTRUMENT
+                        results[c].counters.merge(threadCounters);
+#endif
+                    });
+                }
+            }
+            if (tasks.empty()) break;
+
+            WorkStealingPool pool(threads);
+            pool.run(tasks);
+            for (auto& result : results) result.samples = result.agentWins + result.botWins;
+        }
+        collectSquareCacheStats();
+        return results;
+    }
+
+    int replicaLimit() const {
+        return replicaEnd < 0 ? simulations : std::min(simulations, replicaEnd);
+    }
+
+    bool needsMoreReplicas(const SweepResult& result) const {
+        if (replicaBegin + result.samples >= replicaLimit()) return false;
+        if (targetHalfWidth <= 0.0 || result.samples == 0) return true;
+        Interval interval = wilsonInterval(result.agentWins, result.samples);
+        return (interval.high - interval.low) / 2.0 > targetHalfWidth;
+    }
+
+    std::vector<PointEstimate> estimatePoints(const std::vector<SweepPoint>& points, int pointSamples) {
+        prepareSquareCaches();
+        std::vector<PointEstimate> estimates(points.size());
+        std::vector<std::mutex> estimateLocks(points.size());
+        std::vector<std::map<int, std::unique_ptr<MatchType>>> matchCache(threads);
+        int chunks = (pointSamples + POINTS_PER_TASK - 1) / POINTS_PER_TASK;
+
+        std::vector<WorkStealingPool::Task> tasks;
+        for (size_t c = 0; c < points.size(); c++) {
+            for (int chunk = 0; chunk < chunks; chunk++) {
+                tasks.push_back([&, c, chunk](int worker) {
+                    const SweepPoint& point = points[c];
+                    MatchType& match = cachedMatch(matchCache[worker], point);
+                    configureStrategy(match.strategy, worker);
+                    match.reset(point.r_agent, point.l_agent, point.r_robot, point.l_robot,
+                        splitMix64(splitMix64(masterSeed) ^ splitMix64(point.index * chunks + chunk)));
+                    PointEstimate estimate;
+                    match.samplePoints(std::min(POINTS_PER_TASK, pointSamples - chunk * POINTS_PER_TASK), estimate);
+
+                    std::lock_guard<std::mutex> lock(estimateLocks[c]);
+                    estimates[c].merge(estimate);
+                });
+            }
+        }
+
+        WorkStealingPool pool(threads);
+        pool.run(tasks);
+        collectSquareCacheStats();
+        return estimates;
+    }
+
+    std::uint64_t replicaSeed(std::uint64_t configIndex, int replica) const {
+        return splitMix64(masterSeed ^ splitMix64(configIndex * simulations + replica));
+    }
+
+private:
+    static const int REPLICAS_PER_TASK = 64;
+    static const int POINTS_PER_TASK = 4096;
+    int simulations;
+    int bestOfSets;
+    std::uint64_t masterSeed;
+    int threads;
+    std::vector<std::unique_ptr<BestSquareCache>> squareCaches;
+
+    void prepareSquareCaches() {
+        if (!useSquareCache || !squareCaches.empty()) return;
+        for (int worker = 0; worker < threads; worker++) {
+            squareCaches.push_back(std::make_unique<BestSquareCache>());
+            squareCaches.back()->exact = exactSquareCache;
+            squareCaches.back()->step = squareCacheStep;
+        }
+    }
+
+    BestSquareCache* workerSquareCache(int worker) {
+        return squareCaches.empty() ? nullptr : squareCaches[worker].get();
+    }
+
+    template <class Policy>
+    void configureStrategy(Policy& strategy, int worker) {
+        attachSquareCache(strategy, workerSquareCache(worker), 0);
+        setAimResolution(strategy, aimResolution, 0);
+    }
+
+    void collectSquareCacheStats() {
+        for (auto& cache : squareCaches) {
+            squareCacheStats.merge(cache->stats);
+            cache->stats = SquareCacheStats();
+        }
+    }
+
+    MatchType& cachedMatch(std::map<int, std::unique_ptr<MatchType>>& cache, const SweepPoint& point) {
+        auto& match = cache[point.n];
+        if (!match) match = std::make_unique<MatchType>(point.r_agent, point.l_agent, point.r_robot, point.l_robot, point.n, 0);
+        return *match;
+    }
+};
+
+struct ColumnSpec {
+    enum Type : std::uint8_t { Int64 = 1, Float64 = 2 };
+
+    std::string name;
+    Type type;
+    int precision;
+};
+
+class ColumnarWriter {
+public:
+    ColumnarWriter(const std::string& path, std::vector<ColumnSpec> columnSpecs)
+        : out(path, std::ios::binary), columns(std::move(columnSpecs)), block(columns.size()) {
+        writeHeader();
+        flusher = std::thread([this] { flushLoop(); });
+    }
+
+    ~ColumnarWriter() {
+        close();
+    }
+
+    bool isOpen() const {
+        return out.is_open();
+    }
+
+    ColumnarWriter& put(double value) {
+        if (columns[column].type == ColumnSpec::Int64) append(block[column], static_cast<std::int64_t>(value));
+        else append(block[column], value);
+        return nextColumn();
+    }
+
+    ColumnarWriter& put(std::int64_t value) {
+        if (columns[column].type == ColumnSpec::Int64) append(block[column], value);
+        else append(block[column], static_cast<double>(value));
+        return nextColumn();
+    }
+
+    ColumnarWriter& put(int value) {
+        return put(static_cast<std::int64_t>(value));
+    }
+
+    void close() {
+        if (!flusher.joinable()) return;
+        if (rows > 0) submit();
+        {
+            std::lock_guard<std::mutex> lock(queueLock);
+            finished = true;
+        }
+        queueReady.notify_all();
+        flusher.join();
+        std::uint32_t endMarker = 0;
+        out.write(reinterpret_cast<const char*>(&endMarker), sizeof(endMarker));
+        out.close();
+    }
+
+private:
+    static const std::uint32_t BLOCK_ROWS = 4096;
+    static const size_t MAX_PENDING_BLOCKS = 2;
+    std::ofstream out;
+    std::vector<ColumnSpec> columns;
+    std::vector<std::vector<char>> block;
+    size_t column = 0;
+    std::uint32_t rows = 0;
+    std::deque<std::vector<char>> pending;
+    std::mutex queueLock;
+    std::condition_variable queueReady;
+    std::condition_variable queueSpace;
+    bool finished = false;
+    std::thread flusher;
+
+    template <class T>
+    static void append(std::vector<char>& bytes, const T& value) {
+        const char* raw = reinterpret_cast<const char*>(&value);
+        bytes.insert(bytes.end(), raw, raw + sizeof(T));
+    }
+
+    void writeHeader() {
+        std::vector<char> bytes = { 'L', '3', 'R', 'C' };
+        append(bytes, static_cast<std::uint32_t>(1));
+        append(bytes, static_cast<std::uint32_t>(columns.size()));
+        for (const auto& spec : columns) {
+            append(bytes, static_cast<std::uint8_t>(spec.type));
+            append(bytes, static_cast<std::uint8_t>(spec.precision));
+            append(bytes, static_cast<std::uint16_t>(spec.name.size()));
+            bytes.insert(bytes.end(), spec.name.begin(), spec.name.end());
+        }
+        out.write(bytes.data(), bytes.size());
+    }
+
+    ColumnarWriter& nextColumn() {
+        if (++column < columns.size()) return *this;
+        column = 0;
+        if (++rows == BLOCK_ROWS) submit();
+        return *this;
+    }
+
+    void submit() {
+        std::vector<char> bytes;
+        bytes.reserve(sizeof(std::uint32_t) + static_cast<size_t>(rows) * columns.size() * 8);
+        append(bytes, rows);
+        for (auto& values : block) {
+            bytes.insert(bytes.end(), values.begin(), values.end());
+            values.clear();
+        }
+        rows = 0;
+
+        std::unique_lock<std::mutex> lock(queueLock);
+        queueSpace.wait(lock, [&] { return pending.size() < MAX_PENDING_BLOCKS; });
+        pending.push_back(std::move(bytes));
+        queueReady.notify_one();
+    }
+
+    void flushLoop() {
+        std::unique_lock<std::mutex> lock(queueLock);
+        while (true) {
+            queueReady.wait(lock, [&] { return finished || !pending.empty(); });
+            if (pending.empty()) return;
+            std::vector<char> bytes = std::move(pending.front());
+            pending.pop_front();
+            queueSpace.notify_one();
+            lock.unlock();
+            out.write(bytes.data(), bytes.size());
+            lock.lock();
+        }
+    }
+};
+
+inline bool convertColumnarToCsv(const std::string& inputPath, std::ostream& csv) {
+    std::ifstream in(inputPath, std::ios::binary | std::ios::ate);
+    if (!in) return false;
+    std::streamoff fileSize = in.tellg();
+    in.seekg(0);
+    auto remaining = [&]() { return static_cast<std::uint64_t>(fileSize - in.tellg()); };
+    char magic[4];
+    std::uint32_t version = 0, columnCount = 0;
+    if (!in.read(magic, 4) || std::string(magic, 4) != "L3RC") return false;
+    in.read(reinterpret_cast<char*>(&version), sizeof(version));
+    in.read(reinterpret_cast<char*>(&columnCount), sizeof(columnCount));
+    if (!in || version != 1 || columnCount == 0 || remaining() / 4 < columnCount) return false;
+
+    std::vector<ColumnSpec> columns(columnCount);
+    for (auto& spec : columns) {
+        std::uint8_t type = 0, precision = 0;
+        std::uint16_t length = 0;
+        in.read(reinterpret_cast<char*>(&type), sizeof(type));
+        in.read(reinterpret_cast<char*>(&precision), sizeof(precision));
+        in.read(reinterpret_cast<char*>(&length), sizeof(length));
+        if (!in || (type != ColumnSpec::Int64 && type != ColumnSpec::Float64) || remaining() < length) return false;
+        spec.name.resize(length);
+        in.read(&spec.name[0], length);
+        spec.type = static_cast<ColumnSpec::Type>(type);
+        spec.precision = precision;
+    }
+    if (!in) return false;
+
+    for (size_t c = 0; c < columns.size(); c++) csv << (c ? ";" : "") << columns[c].name;
+    csv << "\n";
+
+    std::vector<std::vector<char>> data(columnCount);
+    while (true) {
+        std::uint32_t rows = 0;
+        if (!in.read(reinterpret_cast<char*>(&rows), sizeof(rows))) return false;
+        if (rows == 0) return true;
+        if (remaining() / 8 / columnCount < rows) return false;
+        for (auto& values : data) {
+            values.resize(static_cast<size_t>(rows) * 8);
+            if (!in.read(values.data(), values.size())) return false;
+        }
+        for (std::uint32_t row = 0; row < rows; row++) {
+            for (size_t c = 0; c < columns.size(); c++) {
+                if (c) csv << ";";
+                const char* raw = data[c].data() + static_cast<size_t>(row) * 8;
+                if (columns[c].type == ColumnSpec::Int64) {
+                    std::int64_t value;
+                    std::memcpy(&value, raw, sizeof(value));
+                    csv << value;
+                }
+                else {
+                    double value;
+                    std::memcpy(&value, raw, sizeof(value));
+                    csv << std::fixed << std::setprecision(columns[c].precision) << value;
+                }
+            }
+            csv << "\n";
+        }
+    }
+}
+
+inline bool truncatePartialRow(const std::string& path) {
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in) return true;
+    std::streamoff size = in.tellg(), end = size;
+    char c;
+    while (end > 0 && in.seekg(end - 1) && in.get(c) && c != '\n') end--;
+    in.close();
+    if (end == size) return true;
+    std::error_code error;
+    std::filesystem::resize_file(path, static_cast<std::uintmax_t>(end), error);
+    return !error;
+}
+
+inline bool openCsv(std::ofstream& out, const std::string& path, const std::string& header, bool append) {
+    if (append) {
+        if (!truncatePartialRow(path)) return false;
+        std::ifstream existing(path);
+        if (existing && existing.peek() != std::ifstream::traits_type::eof()) {
+            out.open(path, std::ios::app);
+            return out.is_open();
+        }
+    }
+    out.open(path);
+    out << header << "\n";
+    return out.is_open();
+}
+
+inline bool parseConfigIndex(const std::string& text, std::uint64_t& index) {
+    if (text.empty() || text.find_first_not_of("0123456789") != std::string::npos) return false;
+    try {
+        index = std::stoull(text);
+    }
+    catch (const std::out_of_range&) {
+        return false;
+    }
+    return true;
+}
+
+inline bool readCompletedConfigs(const std::string& path, int aimResolution, std::vector<std::uint64_t>& completed, std::string& error) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return true;
+    std::string line, field;
+    if (!std::getline(in, line) || in.eof()) return true;
+    std::istringstream header(line);
+    int columns = 0, configColumn = -1, aimColumn = -1;
+    while (std::getline(header, field, ';')) {
+        if (field == "config") configColumn = columns;
+        if (field == "aim_resolution") aimColumn = columns;
+        columns++;
+    }
+    if (configColumn < 0 || aimColumn < 0) {
+        error = configColumn < 0 ? "нет столбца config" : "нет столбца aim_resolution";
+        return false;
+    }
+    long long lineNumber = 1;
+    while (std::getline(in, line)) {
+        lineNumber++;
+        if (in.eof()) break;
+        if (line.empty()) continue;
+        if (std::count(line.begin(), line.end(), ';') + 1 != columns) {
+            error = "строка " + std::to_string(lineNumber) + ": ожидалось столбцов " + std::to_string(columns);
+            return false;
+        }
+        std::istringstream row(line);
+        std::string config, aim;
+        for (int k = 0; std::getline(row, field, ';'); k++) {
+            if (k == configColumn) config = field;
+            if (k == aimColumn) aim = field;
+        }
+        std::uint64_t index;
+        if (!parseConfigIndex(config, index)) {
+            error = "строка " + std::to_string(lineNumber) + ": неверный номер конфигурации \"" + config + "\"";
+            return false;
+        }
+        if (aim != std::to_string(aimResolution)) {
+            error = "строка " + std::to_string(lineNumber) + ": посчитана с aim_resolution = " + aim
+                + ", а не " + std::to_string(aimResolution);
+            return false;
+        }
+        completed.push_back(index);
+    }
+    std::sort(completed.begin(), completed.end());
+    return true;
+}
+
+inline bool readPartialResults(const std::string& path, std::map<std::uint64_t, SweepResult>& merged,
+    int& aimResolution, std::string& error) {
+    std::ifstream in(path);
+    std::string line;
+    if (!std::getline(in, line) || line != "config;aim_resolution;agentWins;botWins;points;shots;longestRally") {
+        error = "неверный заголовок";
+        return false;
+    }
+    while (std::getline(in, line)) {
+        if (line.empty()) continue;
+        std::uint64_t index;
+        long long agentWins, botWins, points, shots;
+        int aim, longestRally;
+        char separator;
+        std::istringstream row(line);
+        row >> index >> separator >> aim >> separator >> agentWins >> separator >> botWins >> separator
+            >> points >> separator >> shots >> separator >> longestRally;
+        if (!row) {
+            error = "неверная строка \"" + line + "\"";
+            return false;
+        }
+        if (aimResolution < 0) aimResolution = aim;
+        if (aim != aimResolution) {
+            error = "конфигурация " + std::to_string(index) + " посчитана с aim_resolution = " + std::to_string(aim)
+                + ", а не " + std::to_string(aimResolution);
+            return false;
+        }
+        SweepResult& result = merged[index];
+        result.agentWins += static_cast<int>(agentWins);
+        result.botWins += static_cast<int>(botWins);
+        result.samples = result.agentWins + result.botWins;
+        RallyStats rally;
+        rally.points = points;
+        rally.shots = shots;
+        rally.longestRally = longestRally;
+        result.rallyStats.merge(rally);
+    }
+    return true;
+}
+
+class SweepOutput {
+public:
+    std::string partialPath;
+    bool binary = false;
+    bool quiet = false;
+    bool rallyStats = false;
+    bool analytic = false;
+    bool crossCheck = false;
+    bool fullSimulation = true;
+    bool append = false;
+    int bestOfSets = 2;
+    int aimResolution = 0;
+
+    bool open() {
+        if (analytic) {
+            std::string header = "r_agent;l_agent;n;points;pServe;pRally;agentWinProbability;ciLow;ciHigh";
+            if (crossCheck) header += ";simulatedProbability;simLow;simHigh;consistent";
+            if (!openCsv(analyticResults, "analytic.csv", header + ";r_robot;l_robot;aim_resolution;config", append)) return fail("analytic.csv");
+        }
+        if (!fullSimulation) return true;
+
+        if (!partialPath.empty()) {
+            if (!openCsv(results, partialPath, "config;aim_resolution;agentWins;botWins;points;shots;longestRally", append))
+                return fail(partialPath.c_str());
+            return true;
+        }
+        if (binary) {
+            binaryResults = std::make_unique<ColumnarWriter>("results.bin", std::vector<ColumnSpec>{
+                { "r_agent", ColumnSpec::Float64, 2 }, { "l_agent", ColumnSpec::Float64, 2 }, { "n", ColumnSpec::Int64, 0 },
+                { "agentWins", ColumnSpec::Int64, 0 }, { "botWins", ColumnSpec::Int64, 0 },
+                { "agentWinProbability", ColumnSpec::Float64, 2 }, { "samples", ColumnSpec::Int64, 0 },
+                { "ciLow", ColumnSpec::Float64, 4 }, { "ciHigh", ColumnSpec::Float64, 4 },
+                { "r_robot", ColumnSpec::Float64, 2 }, { "l_robot", ColumnSpec::Float64, 2 },
+                { "aim_resolution", ColumnSpec::Int64, 0 }, { "config", ColumnSpec::Int64, 0 } });
+            if (!binaryResults->isOpen()) return fail("results.bin");
+        }
+        else if (!openCsv(results, "results.csv",
+            "r_agent;l_agent;n;agentWins;botWins;agentWinProbability;samples;ciLow;ciHigh;r_robot;l_robot;aim_resolution;config", append)) {
+            return fail("results.csv");
+        }
+
+        if (rallyStats && !openCsv(rallyResults, "rally_lengths.csv",
+            "r_agent;l_agent;n;points;shots;meanRally;longestRally;aim_resolution;config", append)) {
+            return fail("rally_lengths.csv");
+        }
+#ifdef LAB3_INSTRUMENT
+        if (!openCsv(instrumentation, "instrumentation.csv",
+            "r_agent;l_agent;n;points;shots;agentOutBalls;botOutBalls;errorPerturbations;errorOffCourt;"
+            "botMisses;agentMisses;chooseCycles;moveCycles;rallyCycles;aim_resolution;config", append)) {
+            return fail("instrumentation.csv");
+        }
+#endif
+        return true;
+    }
+
+    void writeAnalytic(const std::vector<SweepPoint>& points, const std::vector<PointEstimate>& estimates,
+        const std::vector<SweepResult>& sweep) {
+        for (size_t c = 0; c < points.size(); c++) {
+            const SweepPoint& point = points[c];
+            const PointEstimate& estimate = estimates[c];
+            double p[PointEstimate::STATES], low[PointEstimate::STATES], high[PointEstimate::STATES];
+            for (int k = 0; k < PointEstimate::STATES; k++) {
+                Interval interval = wilsonInterval(estimate.wins[k], estimate.points[k]);
+                p[k] = estimate.points[k] ? static_cast<double>(estimate.wins[k]) / estimate.points[k] : 0.5;
+                low[k] = interval.low;
+                high[k] = interval.high;
+            }
+            long long rallyPoints = estimate.totalPoints(1);
+            double pServe = p[0];
+            double pRally = rallyPoints ? static_cast<double>(estimate.totalWins(1)) / rallyPoints : 0.0;
+            double probability = matchWinProbability(p, bestOfSets);
+            Interval ci = { matchWinProbability(low, bestOfSets), matchWinProbability(high, bestOfSets) };
+
+            analyticResults << std::fixed << std::setprecision(4)
+                << point.r_agent << ";" << point.l_agent << ";" << point.n << ";"
+                << estimate.totalPoints() << ";" << pServe << ";" << pRally << ";"
+                << probability << ";" << ci.low << ";" << ci.high;
+            if (crossCheck) {
+                Interval simulated = wilsonInterval(sweep[c].agentWins, sweep[c].samples);
+                bool overlap = simulated.low <= ci.high && ci.low <= simulated.high;
+                consistent += overlap;
+                analyticResults << ";" << static_cast<double>(sweep[c].agentWins) / sweep[c].samples << ";"
+                    << simulated.low << ";" << simulated.high << ";" << (overlap ? 1 : 0);
+            }
+            analyticResults << ";" << point.r_robot << ";" << point.l_robot << ";" << aimResolution << ";" << point.index << "\n";
+            analyticRows++;
+        }
+    }
+
+    void writeSimulated(const std::vector<SweepResult>& sweep) {
+        if (!partialPath.empty()) {
+            for (const auto& result : sweep) {
+                results << result.point.index << ";" << aimResolution << ";" << result.agentWins << ";" << result.botWins << ";"
+                    << result.rallyStats.points << ";" << result.rallyStats.shots << ";" << result.rallyStats.longestRally << "\n";
+            }
+            return;
+        }
+        if (!quiet && !bannerShown) {
+            bannerShown = true;
+            std::cout << "---------------------------------------------------------\n";
+            std::cout << "        МОДЕЛИРОВАНИЕ МАТЧЕЙ: АГЕНТ против БОЛВАНЧИКА   \n";
+            std::cout << "---------------------------------------------------------\n\n";
+        }
+
+        for (const auto& result : sweep) {
+            const SweepPoint& point = result.point;
+            if (!quiet && point.n != currentN) {
+                currentN = point.n;
+                std::cout << "==================== ПАРАМЕТР n = " << point.n << " ====================\n";
+            }
+
+            double winProbability = result.samples ? static_cast<double>(result.agentWins) / result.samples : 0.0;
+            Interval interval = wilsonInterval(result.agentWins, result.samples);
+            if (binaryResults) {
+                binaryResults->put(point.r_agent).put(point.l_agent).put(point.n)
+                    .put(result.agentWins).put(result.botWins).put(winProbability)
+                    .put(result.samples).put(interval.low).put(interval.high)
+                    .put(point.r_robot).put(point.l_robot).put(aimResolution).put(static_cast<std::int64_t>(point.index));
+            }
+            else {
+                writeResultRow(results, result, aimResolution);
+            }
+
+            if (rallyStats) {
+                rallyResults << std::fixed << std::setprecision(2)
+                    << point.r_agent << ";" << point.l_agent << ";" << point.n << ";"
+                    << result.rallyStats.points << ";" << result.rallyStats.shots << ";"
+                    << result.rallyStats.meanRally() << ";" << result.rallyStats.longestRally << ";" << aimResolution << ";" << point.index << "\n";
+            }
+
+#ifdef LAB3_INSTRUMENT
+            const MatchCounters& counters = result.counters;
+            instrumentation << std::fixed << std::setprecision(2)
+                << point.r_agent << ";" << point.l_agent << ";" << point.n << ";"
+                << counters.points << ";" << counters.shots << ";" << counters.agentOutBalls << ";" << counters.botOutBalls << ";"
+                << counters.errorPerturbations << ";" << counters.errorOffCourt << ";"
+                << counters.botMisses << ";" << counters.agentMisses << ";"
+                << counters.chooseCycles << ";" << counters.moveCycles << ";" << counters.rallyCycles << ";"
+                << aimResolution << ";" << point.index << "\n";
+#endif
+
+            if (quiet) continue;
+            std::cout << std::fixed << std::setprecision(2)
+                << "- Радиус действия агента r = " << point.r_agent
+                << ", Макс. перемещение l = " << point.l_agent << "\n"
+                << "   Побед агента: " << result.agentWins
+                << " из " << result.samples
+                << " (" << winProbability * 100 << "%)\n\n";
+        }
+    }
+
+    static void writeResultRow(std::ostream& out, const SweepResult& result, int aimResolution) {
+        const SweepPoint& point = result.point;
+        double winProbability = result.samples ? static_cast<double>(result.agentWins) / result.samples : 0.0;
+        Interval interval = wilsonInterval(result.agentWins, result.samples);
+        out << std::fixed << std::setprecision(2)
+            << point.r_agent << ";" << point.l_agent << ";" << point.n << ";"
+            << result.agentWins << ";" << result.botWins << ";"
+            << winProbability << ";" << result.samples << ";"
+            << std::setprecision(4) << interval.low << ";" << interval.high << ";"
+            << std::setprecision(2) << point.r_robot << ";" << point.l_robot << ";" << aimResolution << ";" << point.index << "\n";
+    }
+
+    void finish() {
+        if (binaryResults) binaryResults->close();
+        results.close();
+        rallyResults.close();
+        if (analytic) {
+            analyticResults.close();
+            std::cout << "Аналитическая оценка записана в analytic.csv\n";
+            if (crossCheck) std::cout << "Согласованных конфигураций: " << consistent << " из " << analyticRows << "\n";
+        }
+#ifdef LAB3_INSTRUMENT
+        instrumentation.close();
+        std::cout << "Счётчики инструментирования в instrumentation.csv\n";
+#endif
+        if (!quiet && fullSimulation) {
+            std::string path = !partialPath.empty() ? partialPath : binary ? "results.bin" : "results.csv";
+            std::cout << "Симуляция завершена. Результаты в " << path << "\n";
+        }
+    }
+
+private:
+    std::ofstream results;
+    std::unique_ptr<ColumnarWriter> binaryResults;
+    std::ofstream rallyResults;
+    std::ofstream analyticResults;
+    std::ofstream instrumentation;
+    bool bannerShown = false;
+    int currentN = -1;
+    int consistent = 0;
+    size_t analyticRows = 0;
+
+    static bool fail(const char* path) {
+        std::cerr << "Не удалось открыть файл результатов: " << path << "\n";
+        return false;
+    }
+};
+
+struct BenchmarkRow {
+    std::string lab;
+    std::string workload;
+    int threads = 0;
+    std::uint64_t seed = 0;
+    double setupMs = 0.0;
+    double runMs = 0.0;
+    double outputMs = 0.0;
+    std::string unit;
+    long long count = 0;
+    double perSec = 0.0;
+    long long peakRssKb = 0;
+    std::uint64_t checksum = 0;
+};
+
+inline long long peakResidentKb() {
+#ifdef LAB3_RUSAGE
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#else
+    return 0;
+#endif
+}
+
+class BenchmarkTable {
+public:
+    static void writeHeader(std::ostream& out) {
+        out << "lab;workload;threads;seed;setupMs;runMs;outputMs;unit;count;perSec;peakRssKb;checksum\n";
+    }
+
+    static void write(std::ostream& out, const BenchmarkRow& row) {
+        out << std::defaultfloat << std::setprecision(6)
+            << row.lab << ";" << row.workload << ";" << row.threads << ";" << row.seed << ";"
+            << row.setupMs << ";" << row.runMs << ";" << row.outputMs << ";" << row.unit << ";"
+            << row.count << ";" << row.perSec << ";" << row.peakRssKb << ";" << row.checksum << "\n";
+    }
+
+    static std::vector<BenchmarkRow> read(std::istream& in) {
+        std::vector<BenchmarkRow> rows;
+        std::string line;
+        while (std::getline(in, line)) {
+            std::vector<std::string> fields;
+            std::stringstream stream(line);
+            std::string field;
+            while (std::getline(stream, field, ';')) fields.push_back(field);
+            if (fields.size() != 12 || fields[0] == "lab") continue;
+            BenchmarkRow row;
+            row.lab = fields[0];
+            row.workload = fields[1];
+            row.threads = std::stoi(fields[2]);
+            row.seed = std::stoull(fields[3]);
+            row.setupMs = std::stod(fields[4]);
+            row.runMs = std::stod(fields[5]);
+            row.outputMs = std::stod(fields[6]);
+            row.unit = fields[7];
+            row.count = std::stoll(fields[8]);
+            row.perSec = std::stod(fields[9]);
+            row.peakRssKb = std::stoll(fields[10]);
+            row.checksum = std::stoull(fields[11]);
+            rows.push_back(row);
+        }
+        return rows;
+    }
+
+    static bool compare(std::ostream& out, const std::vector<BenchmarkRow>& baseline, const std::vector<BenchmarkRow>& current,
+        double tolerance) {
+        bool regressed = false;
+        out << std::defaultfloat << std::setprecision(6);
+        out << "lab;workload;threads;baselinePerSec;perSec;ratio;baselineRssKb;peakRssKb;verdict\n";
+        for (const auto& row : current) {
+            auto match = std::find_if(baseline.begin(), baseline.end(), [&](const BenchmarkRow& old) {
+                return old.lab == row.lab && old.workload == row.workload && old.threads == row.threads;
+            });
+            out << row.lab << ";" << row.workload << ";" << row.threads << ";";
+            if (match == baseline.end()) {
+                out << "-;" << row.perSec << ";-;-;" << row.peakRssKb << ";new\n";
+                continue;
+            }
+            double ratio = row.perSec / std::max(match->perSec, 1e-12);
+            const char* verdict = "ok";
+            if (match->checksum != row.checksum) verdict = "changed";
+            else if (ratio < 1.0 - tolerance) verdict = "slower";
+            else if (ratio > 1.0 + tolerance) verdict = "faster";
+            if (match->checksum != row.checksum || ratio < 1.0 - tolerance) regressed = true;
+            out << match->perSec << ";" << row.perSec << ";" << ratio << ";"
+                << match->peakRssKb << ";" << row.peakRssKb << ";" << verdict << "\n";
+        }
+        return !regressed;
+    }
+};
+
+class BenchmarkSuite {
+public:
+    explicit BenchmarkSuite(int threads) : threads(std::max(1, threads)) {}
+
+    std::vector<BenchmarkRow> run(std::ostream& out) {
+        std::vector<BenchmarkRow> rows;
+        BenchmarkTable::writeHeader(out);
+        for (int n : { 5, 10, 15 }) {
+            rows.push_back(runWorkload(n));
+            BenchmarkTable::write(out, rows.back());
+            out.flush();
+        }
+        return rows;
+    }
+
+private:
+    static const int SIMULATIONS = 100000;
+    static const int BEST_OF_SETS = 2;
+    static const std::uint64_t SUITE_SEED = 42;
+    int threads;
+
+    static double millisecondsBetween(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end) {
+        return std::chrono::duration<double, std::milli>(end - start).count();
+    }
+
+    BenchmarkRow runWorkload(int n) {
+        BenchmarkRow row;
+        row.lab = "lab3";
+        row.workload = "n" + std::to_string(n);
+        row.threads = threads;
+        row.seed = SUITE_SEED;
+        row.unit = "matches";
+
+        auto start = std::chrono::steady_clock::now();
+        SweepEngine<Xoshiro256StarStar, Strategy> engine(SIMULATIONS, BEST_OF_SETS, SUITE_SEED, threads);
+        std::vector<SweepPoint> points = { { n, 2.0, 2.0, 2.0, 3.0, static_cast<std::uint64_t>(n) } };
+        Court::cached(20.0, 10.0, n);
+        auto setupEnd = std::chrono::steady_clock::now();
+        std::vector<SweepResult> sweep = engine.run(points);
+        auto runEnd = std::chrono::steady_clock::now();
+        std::ostringstream rendered;
+        for (const auto& result : sweep) SweepOutput::writeResultRow(rendered, result, 0);
+        auto outputEnd = std::chrono::steady_clock::now();
+
+        row.setupMs = millisecondsBetween(start, setupEnd);
+        row.runMs = millisecondsBetween(setupEnd, runEnd);
+        row.outputMs = millisecondsBetween(runEnd, outputEnd);
+        row.checksum = SUITE_SEED;
+        for (const auto& result : sweep) {
+            row.checksum = splitMix64(row.checksum ^ static_cast<std::uint64_t>(result.agentWins));
+            row.checksum = splitMix64(row.checksum ^ static_cast<std::uint64_t>(result.botWins));
+            row.count += result.samples;
+        }
+        row.perSec = row.count / std::max(row.runMs / 1000.0, 1e-12);
+        row.peakRssKb = peakResidentKb();
+        return row;
+    }
+};
+
+inline bool parseShard(const std::string& text, std::uint64_t& index, std::uint64_t& count) {
+    size_t slash = text.find('/');
+    if (slash == std::string::npos) return false;
+    if (!parseConfigIndex(text.substr(0, slash), index) || !parseConfigIndex(text.substr(slash + 1), count)) return false;
+    return count >= 1 && count <= 1000000000 && index < count;
+}
+
+int main(int argc, char* argv[]) {
+    setlocale(LC_ALL, "Russian");
+    bool collectRallyStats = false;
+    int simulations = 100;
+    int threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    std::uint64_t seed = std::random_device{}();
+    std::string rngName = "xoshiro";
+    std::string strategyName = "trap";
+    std::string squareCacheMode;
+    double squareCacheStep = 0.05;
+    int aimResolution = 0;
+    bool binaryOutput = false;
+    bool quiet = false;
+    bool batched = false;
+    bool analytic = false;
+    bool crossCheck = false;
+    int pointSamples = 20000;
+    double targetHalfWidth = 0.0;
+    int sequentialChunk = 256;
+    SweepSpec spec;
+    bool resume = false;
+    std::uint64_t rangeFirst = 0, rangeLast = ~std::uint64_t(0);
+    std::uint64_t shardIndex = 0, shardCount = 1;
+    int replicaShardIndex = 0, replicaShardCount = 1;
+    std::string partialPath;
+    std::vector<std::string> mergeFiles;
+    bool benchSuite = false;
+    bool threadsGiven = false;
+    std::string benchBaselinePath;
+    double benchTolerance = 0.15;
+    for (int a = 1; a < argc; a++) {
+        std::string arg = argv[a];
+        if (arg == "--rally-stats") collectRallyStats = true;
+        else if (arg == "--simulations" && a + 1 < argc) simulations = std::stoi(argv[++a]);
+        else if (arg == "--threads" && a + 1 < argc) { threads = std::stoi(argv[++a]); threadsGiven = true; }
+        else if (arg == "--seed" && a + 1 < argc) seed = std::stoull(argv[++a]);
+        else if (arg == "--rng" && a + 1 < argc) rngName = argv[++a];
+        else if (arg == "--batched") batched = true;
+        else if (arg == "--strategy" && a + 1 < argc) strategyName = argv[++a];
+        else if (arg == "--binary-results") binaryOutput = true;
+        else if (arg == "--quiet") quiet = true;
+        else if (arg == "--bench-suite") benchSuite = true;
+        else if (arg == "--bench-baseline" && a + 1 < argc) benchBaselinePath = argv[++a];
+        else if (arg == "--bench-tolerance" && a + 1 < argc) benchTolerance = std::stod(argv[++a]);
+        else if (arg == "--to-csv" && a + 2 < argc) {
+            std::ofstream csv(argv[a + 2]);
+            if (!convertColumnarToCsv(argv[a + 1], csv)) {
+                std::cerr << "Не удалось прочитать файл результатов: " << argv[a + 1] << "\n";
+                return 1;
+            }
+            return 0;
+        }
+        else if (arg == "--square-cache" && a + 1 < argc) squareCacheMode = argv[++a];
+        else if (arg == "--square-cache-step" && a + 1 < argc) squareCacheStep = std::stod(argv[++a]);
+        else if (arg == "--aim-resolution" && a + 1 < argc) aimResolution = std::stoi(argv[++a]);
+        else if (arg == "--analytic") analytic = true;
+        else if (arg == "--cross-check") analytic = crossCheck = true;
+        else if (arg == "--points" && a + 1 < argc) pointSamples = std::stoi(argv[++a]);
+        else if (arg == "--half-width" && a + 1 < argc) targetHalfWidth = std::stod(argv[++a]);
+        else if (arg == "--chunk" && a + 1 < argc) sequentialChunk = std::stoi(argv[++a]);
+        else if (arg == "--resume") resume = true;
+        else if (arg == "--partial" && a + 1 < argc) partialPath = argv[++a];
+        else if (arg == "--merge") {
+            while (a + 1 < argc && std::string(argv[a + 1]).compare(0, 2, "--") != 0) mergeFiles.push_back(argv[++a]);
+            if (mergeFiles.empty()) {
+                std::cerr << "Не указаны файлы для объединения после --merge\n";
+                return 1;
+            }
+        }
+        else if (arg == "--replica-shard" && a + 1 < argc) {
+            std::uint64_t index, count;
+            if (!parseShard(argv[++a], index, count)) {
+                std::cerr << "Неверный номер части: " << argv[a] << " (ожидается k/N, где N >= 1 и 0 <= k < N)\n";
+                return 1;
+            }
+            replicaShardIndex = static_cast<int>(index);
+            replicaShardCount = static_cast<int>(count);
+        }
+        else if (arg == "--range" && a + 1 < argc) {
+            std::string range = argv[++a];
+            size_t colon = range.find(':');
+            rangeFirst = std::stoull(range.substr(0, colon));
+            if (colon != std::string::npos) rangeLast = std::stoull(range.substr(colon + 1));
+        }
+        else if (arg == "--shard" && a + 1 < argc) {
+            if (!parseShard(argv[++a], shardIndex, shardCount)) {
+                std::cerr << "Неверный номер части: " << argv[a] << " (ожидается k/N, где N >= 1 и 0 <= k < N)\n";
+                return 1;
+            }
+        }
+        else if (arg == "--sweep-spec" && a + 1 < argc) {
+            std::string badLine;
+            if (!spec.load(argv[++a], badLine)) {
+                if (badLine.empty()) std::cerr << "Не удалось прочитать описание перебора: " << argv[a] << "\n";
+                else std::cerr << "Неверная ось перебора в " << argv[a] << ": " << badLine << "\n" << SweepSpec::AXIS_USAGE;
+                return 1;
+            }
+        }
+        else if (arg == "--axis" && a + 1 < argc) {
+            if (!spec.setAxis(argv[++a])) {
+                std::cerr << "Неверная ось перебора: " << argv[a] << "\n" << SweepSpec::AXIS_USAGE;
+                return 1;
+            }
+        }
+    }
+
+    if (benchSuite) {
+        std::vector<BenchmarkRow> baseline;
+        if (!benchBaselinePath.empty()) {
+            std::ifstream in(benchBaselinePath);
+            if (!in) {
+                std::cerr << "Не удалось открыть базовые результаты: " << benchBaselinePath << "\n";
+                return 1;
+            }
+            baseline = BenchmarkTable::read(in);
+        }
+        BenchmarkSuite suite(threadsGiven ? threads : 1);
+        std::vector<BenchmarkRow> rows = suite.run(std::cout);
+        if (benchBaselinePath.empty()) return 0;
+        return BenchmarkTable::compare(std::cerr, baseline, rows, benchTolerance) ? 0 : 2;
+    }
+
+    if (aimResolution < 0 || (aimResolution > 0 && aimResolution <= spec.largestN())) {
+        std::cerr << "--aim-resolution должно быть больше наибольшего n в переборе (" << spec.largestN() << ")\n";
+        return 1;
+    }
+
+    const int bestOfSets = 2;
+    const std::uint64_t sweepBlock = 4096;
+
+    std::uint64_t total = spec.size();
+    std::uint64_t first = std::min(total, total / shardCount * shardIndex + std::min(shardIndex, total % shardCount));
+    std::uint64_t last = std::min(total, total / shardCount * (shardIndex + 1) + std::min(shardIndex + 1, total % shardCount));
+    first = std::max(first, std::min(rangeFirst, total));
+    last = std::min(last, rangeLast);
+
+    bool fullSimulation = !analytic || crossCheck;
+    if (replicaShardCount > 1 && (partialPath.empty() || targetHalfWidth > 0.0 || analytic)) {
+        std::cerr << "--replica-shard требует --partial и несовместим с --half-width и --analytic\n";
+        return 1;
+    }
+
+    if (!mergeFiles.empty()) {
+        std::map<std::uint64_t, SweepResult> merged;
+        int mergedAimResolution = -1;
+        for (const auto& path : mergeFiles) {
+            std::string error;
+            if (!readPartialResults(path, merged, mergedAimResolution, error)) {
+                std::cerr << "Не удалось прочитать частичные результаты " << path << ": " << error << "\n";
+                return 1;
+            }
+        }
+        std::vector<SweepResult> sweep;
+        for (auto& entry : merged) {
+            if (entry.first >= total) {
+                std::cerr << "Конфигурация " << entry.first << " вне описания перебора\n";
+                return 1;
+            }
+            entry.second.point = spec.at(entry.first);
+            sweep.push_back(entry.second);
+        }
+
+        SweepOutput output;
+        output.binary = binaryOutput;
+        output.quiet = quiet;
+        output.rallyStats = collectRallyStats;
+        output.bestOfSets = bestOfSets;
+        output.aimResolution = std::max(mergedAimResolution, 0);
+        if (!output.open()) return 1;
+        output.writeSimulated(sweep);
+        output.finish();
+        return 0;
+    }
+
+    std::vector<std::uint64_t> completed;
+    if (resume) {
+        if (binaryOutput && fullSimulation) {
+            std::cerr << "Продолжение перебора поддерживается только для CSV-результатов\n";
+            return 1;
+        }
+        std::string primary = !fullSimulation ? "analytic.csv" : !partialPath.empty() ? partialPath : "results.csv";
+        std::string error;
+        if (!readCompletedConfigs(primary, aimResolution, completed, error)) {
+            std::cerr << "Не удалось прочитать " << primary << ": " << error << "\n";
+            return 1;
+        }
+    }
+
+    SweepOutput output;
+    output.partialPath = partialPath;
+    output.binary = binaryOutput;
+    output.quiet = quiet;
+    output.rallyStats = collectRallyStats;
+    output.analytic = analytic;
+    output.crossCheck = crossCheck;
+    output.fullSimulation = fullSimulation;
+    output.append = resume;
+    output.bestOfSets = bestOfSets;
+    output.aimResolution = aimResolution;
+    if (!output.open()) return 1;
+
+    SquareCacheStats squareCacheStats;
+    auto execute = [&](auto& engine) {
+        engine.collectRallyStats = collectRallyStats;
+        engine.batched = batched;
+        engine.targetHalfWidth = targetHalfWidth;
+        engine.sequentialChunk = sequentialChunk;
+        engine.useSquareCache = !squareCacheMode.empty();
+        engine.exactSquareCache = squareCacheMode != "approx";
+        engine.squareCacheStep = squareCacheStep;
+        engine.aimResolution = aimResolution;
+        engine.replicaBegin = static_cast<int>(static_cast<long long>(simulations) * replicaShardIndex / replicaShardCount);
+        engine.replicaEnd = static_cast<int>(static_cast<long long>(simulations) * (replicaShardIndex + 1) / replicaShardCount);
+
+        std::vector<SweepPoint> points;
+        std::vector<SweepResult> sweep;
+        std::vector<PointEstimate> estimates;
+        for (std::uint64_t blockStart = first; blockStart < last; blockStart += sweepBlock) {
+            std::uint64_t blockEnd = std::min(last, blockStart + sweepBlock);
+            points.clear();
+            for (std::uint64_t index = blockStart; index < blockEnd; index++) {
+                if (!std::binary_search(completed.begin(), completed.end(), index)) points.push_back(spec.at(index));
+            }
+            if (points.empty()) continue;
+
+            if (fullSimulation) sweep = engine.run(points);
+            if (analytic) {
+                estimates = engine.estimatePoints(points, pointSamples);
+                output.writeAnalytic(points, estimates, sweep);
+            }
+            if (fullSimulation) output.writeSimulated(sweep);
+        }
+        squareCacheStats = engine.squareCacheStats;
+    };
+    auto runSweep = [&](auto* rngTag, auto* strategyTag) {
+        using RngType = std::remove_pointer_t<decltype(rngTag)>;
+        using StrategyType = std::remove_pointer_t<decltype(strategyTag)>;
+        SweepEngine<RngType, StrategyType> engine(simulations, bestOfSets, seed, threads);
+        execute(engine);
+    };
+    auto withAim = [&](auto* rngTag, auto* aimTag) {
+        using AimType = std::remove_pointer_t<decltype(aimTag)>;
+        if (strategyName == "greedy") runSweep(rngTag, static_cast<GreedyStrategy<AimType>*>(nullptr));
+        else runSweep(rngTag, static_cast<TrapStrategy<AimType>*>(nullptr));
+    };
+    auto withStrategy = [&](auto* rngTag) {
+        if (strategyName == "random") runSweep(rngTag, static_cast<RandomStrategy*>(nullptr));
+        else if (aimResolution > 0) withAim(rngTag, static_cast<HierarchicalAim*>(nullptr));
+        else if (!squareCacheMode.empty()) withAim(rngTag, static_cast<CachedGridAim*>(nullptr));
+        else withAim(rngTag, static_cast<GridAim*>(nullptr));
+    };
+    if (rngName == "std") withStrategy(static_cast<std::default_random_engine*>(nullptr));
+    else withStrategy(static_cast<Xoshiro256StarStar*>(nullptr));
+
+    if (!squareCacheMode.empty()) {
+        std::cout << "Кэш лучших квадратов: обращений " << squareCacheStats.lookups
+            << ", попаданий " << squareCacheStats.hits
+            << " (" << std::fixed << std::setprecision(2) << squareCacheStats.hitRate() * 100 << "%)"
+            << ", проверок кандидатов " << squareCacheStats.rescores
+            << ", пересчётов " << squareCacheStats.fallbacks << "\n";
+    }
 
+    output.finish();
     return 0;
 }